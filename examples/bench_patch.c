@@ -0,0 +1,183 @@
+/*
+ * silkhook - patch backend benchmark
+ * SPDX-License-Identifier: MIT
+ *
+ * toggles a hook in a tight loop while a second thread keeps mapping
+ * and faulting in fresh memory  (what a malloc heavy thread does above
+ * the mmap threshold),  then reports the cost per toggle and that
+ * thread's latency under each patch backend.   mprotect takes mmap_lock
+ * for write,  /proc/self/mem only for read - whether that shows up in
+ * the faulting thread's tail is what this measures,  nothing's assumed
+ *
+ * needs 2+ cpus:  on one the faulting thread only runs when the toggler
+ * is descheduled,  its tail is the scheduler's timeslice either way
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../include/silkhook.h"
+
+#define N_TOGGLE    20000
+#define N_SAMPLES   (1 << 20)
+#define CHUNK       (256 * 1024)
+#define PAGE        4096
+
+typedef int (*fn_t)(int, int);
+static fn_t orig_fn = NULL;
+
+#ifdef __arm__
+#define SILKHOOK_FUNC __attribute__((noinline, target("arm")))
+#else
+#define SILKHOOK_FUNC __attribute__((noinline))
+#endif
+
+SILKHOOK_FUNC
+int target(int x, int y)
+{
+    int a = x + 1;
+    int b = y + 1;
+    return a + b - 2;
+}
+
+SILKHOOK_FUNC
+int detour(int x, int y)
+{
+    return orig_fn(x, y) * 2;
+}
+
+static uint64_t samples[N_SAMPLES];
+static size_t n_samples;
+static volatile int running;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static void *fault_thread(void *arg)
+{
+    (void) arg;
+
+    while (running && n_samples < N_SAMPLES)
+    {
+        uint64_t t0 = now_ns();
+        volatile char *p;
+        size_t i;
+
+        p = mmap(NULL, CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            break;
+
+        for (i = 0; i < CHUNK; i += PAGE)
+            p[i] = 1;
+
+        munmap((void *) p, CHUNK);
+        samples[n_samples++] = now_ns() - t0;
+    }
+    return NULL;
+}
+
+static int run(const char *name, enum silkhook_patch_backend backend)
+{
+    struct silkhook_hook h;
+    pthread_t th;
+    uint64_t t0, t_toggle;
+    int i, r;
+
+    r = silkhook_set_patch_backend(backend);
+    if (r != SILKHOOK_OK)
+    {
+        printf("%-9s skipped: %s\n", name, silkhook_strerror(r));
+        return SILKHOOK_OK;
+    }
+
+    r = silkhook_create((void *) target, (void *) detour, &h, (void **) &orig_fn);
+    if (r != SILKHOOK_OK)
+    {
+        printf("%-9s create failure: %s\n", name, silkhook_strerror(r));
+        return r;
+    }
+
+    n_samples = 0;
+    running = 1;
+    pthread_create(&th, NULL, fault_thread, NULL);
+
+    t0 = now_ns();
+    for (i = 0; i < N_TOGGLE; i++)
+    {
+        r = silkhook_enable(&h);
+        if (r != SILKHOOK_OK)
+            break;
+
+        r = silkhook_disable(&h);
+        if (r != SILKHOOK_OK)
+            break;
+    }
+    t_toggle = now_ns() - t0;
+
+    running = 0;
+    pthread_join(th, NULL);
+
+    /*  timings for patches that never went in would be meaningless  */
+    if (r != SILKHOOK_OK)
+    {
+        printf("%-9s toggle %d failure: %s\n", name, i, silkhook_strerror(r));
+        if (silkhook_is_active(&h))
+            silkhook_disable(&h);
+        silkhook_destroy(&h);
+        return r;
+    }
+
+    silkhook_destroy(&h);
+
+    if (!n_samples)
+    {
+        printf("%-9s no samples\n", name);
+        return SILKHOOK_OK;
+    }
+
+    qsort(samples, n_samples, sizeof(samples[0]), cmp_u64);
+
+    printf("%-9s toggle %6.0f ns | faulting iters %7zu  p50 %7llu  p99 %8llu  p99.9 %8llu  max %9llu ns\n",
+           name, (double) t_toggle / (2.0 * N_TOGGLE), n_samples,
+           (unsigned long long) samples[n_samples / 2],
+           (unsigned long long) samples[(n_samples * 99) / 100],
+           (unsigned long long) samples[(n_samples * 999) / 1000],
+           (unsigned long long) samples[n_samples - 1]);
+    return SILKHOOK_OK;
+}
+
+int main(void)
+{
+    int r = silkhook_init();
+    if (r != SILKHOOK_OK)
+    {
+        printf("silkhook: init failure: %s\n", silkhook_strerror(r));
+        return 1;
+    }
+
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2)
+        printf("note: 1 cpu,  faulting latencies say nothing about mmap_lock\n");
+
+    r = run("mprotect", SILKHOOK_PATCH_MPROTECT);
+    if (r == SILKHOOK_OK)
+        r = run("procmem",  SILKHOOK_PATCH_PROCMEM);
+
+    silkhook_shutdown();
+    return r == SILKHOOK_OK ? 0 : 1;
+}
@@ -0,0 +1,634 @@
+/*
+ * silkhook - entry stub example
+ * SPDX-License-Identifier: MIT
+ *
+ * walks every entry stub type  (gate,  swap,  probe,  sample,  preds,
+ * return / fail,  thread,  epoch)  and checks what each call hit.
+ * exits 1 if any of them didn't match
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "../include/silkhook.h"
+
+#define SILKHOOK_FUNC __attribute__((noinline))
+
+#ifdef __aarch64__
+
+static int fails;
+
+static void expect(const char *what, long long got, long long want)
+{
+    printf("silkhook:    %-32s -> %lld%s\n", what, got, got == want ? "" : "   !!! mismatch");
+    if (got != want)
+        fails++;
+}
+
+static void expect_in(const char *what, long long got, long long lo, long long hi)
+{
+    int ok = got >= lo && got <= hi;
+
+    printf("silkhook:    %-32s -> %lld  (%lld .. %lld)%s\n", what, got, lo, hi,
+           ok ? "" : "   !!! mismatch");
+    if (!ok)
+        fails++;
+}
+
+static int hook_ok(const char *what, int r)
+{
+    if (r == SILKHOOK_OK)
+        return 1;
+
+    printf("silkhook:    %s failure: %s\n", what, silkhook_strerror(r));
+    fails++;
+    return 0;
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * targets
+ *
+ * one per section,  all called through volatile ptrs so nothing gets
+ * folded.   every detour returns orig + 1000  (or a multiple)  so the
+ * result says which path the call took
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+typedef int (*fn_t)(int);
+
+SILKHOOK_FUNC int gate_fn(int x)   { return x + 1; }
+SILKHOOK_FUNC int swap_fn(int x)   { return x + 1; }
+SILKHOOK_FUNC int samp_fn(int x)   { return x + 1; }
+SILKHOOK_FUNC int ret_fn(int x)    { return x + 1; }
+SILKHOOK_FUNC int fail_fn(int x)   { return x + 1; }
+SILKHOOK_FUNC int thread_fn(int x) { return x + 1; }
+SILKHOOK_FUNC int epoch_fn(int x)  { return x + 1; }
+SILKHOOK_FUNC int tick_fn(int x)   { return x + 1; }
+
+SILKHOOK_FUNC
+int probe_fn(int x)
+{
+    int y = x * 3;
+    return y + 1;
+}
+
+SILKHOOK_FUNC
+int probe_nofp_fn(int x)
+{
+    int y = x * 5;
+    return y + 1;
+}
+
+SILKHOOK_FUNC
+uint64_t pred_fn(uint64_t a, uint64_t b, uint64_t c, uint64_t d)
+{
+    return a ^ b ^ c ^ d;
+}
+
+static fn_t volatile gate_ptr   = gate_fn;
+static fn_t volatile swap_ptr   = swap_fn;
+static fn_t volatile samp_ptr   = samp_fn;
+static fn_t volatile probe_ptr  = probe_fn;
+static fn_t volatile probe_nofp_ptr = probe_nofp_fn;
+static fn_t volatile ret_ptr    = ret_fn;
+static fn_t volatile fail_ptr   = fail_fn;
+static fn_t volatile thread_ptr = thread_fn;
+static fn_t volatile epoch_ptr  = epoch_fn;
+static fn_t volatile tick_ptr   = tick_fn;
+static uint64_t (*volatile pred_ptr)(uint64_t, uint64_t, uint64_t, uint64_t) = pred_fn;
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * gate
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static fn_t gate_orig;
+
+SILKHOOK_FUNC int gate_det(int x) { return gate_orig(x) + 1000; }
+
+static void test_gate(void)
+{
+    struct silkhook_opts o = { .flags = SILKHOOK_OPT_GATED,  .group = 3 };
+    struct silkhook_hook h;
+
+    printf("silkhook: gate\n");
+    if (!hook_ok("hook", silkhook_hook_ex((void *) gate_fn, (void *) gate_det, &h,
+                                          (void **) &gate_orig, &o)))
+        return;
+
+    expect("group 3 on", gate_ptr(1), 1002);
+
+    silkhook_group_enable(3, false);
+    expect("group 3 off", gate_ptr(1), 2);
+    expect("gate bit 3", (silkhook_gates() >> 3) & 1, 0);
+
+    silkhook_group_enable(3, true);
+    expect("group 3 back on", gate_ptr(1), 1002);
+
+    silkhook_disable_all_fast();
+    expect("all off", gate_ptr(1), 2);
+
+    silkhook_enable_all_fast();
+    expect("all on", gate_ptr(1), 1002);
+
+    silkhook_unhook(&h);
+    expect("unhooked", gate_ptr(1), 2);
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * detour swap
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static fn_t swap_orig;
+
+SILKHOOK_FUNC int swap_det_a(int x) { return swap_orig(x) + 1000; }
+SILKHOOK_FUNC int swap_det_b(int x) { return swap_orig(x) + 2000; }
+
+static void test_swap(void)
+{
+    struct silkhook_opts o = { .flags = SILKHOOK_OPT_SWAP };
+    struct silkhook_hook h, g;
+
+    printf("silkhook: swap\n");
+    if (!hook_ok("hook", silkhook_hook_ex((void *) swap_fn, (void *) swap_det_a, &h,
+                                          (void **) &swap_orig, &o)))
+        return;
+
+    expect("det_a", swap_ptr(1), 1002);
+
+    silkhook_set_detour(&h, (void *) swap_det_b);
+    expect("det_b", swap_ptr(1), 2002);
+
+    silkhook_set_detour(&h, (void *) swap_det_a);
+    expect("det_a again", swap_ptr(1), 1002);
+
+    silkhook_unhook(&h);
+    expect("unhooked", swap_ptr(1), 2);
+
+    /*  w/o SWAP the detour is baked into the patch  */
+    if (!hook_ok("plain hook", silkhook_hook((void *) swap_fn, (void *) swap_det_a, &g,
+                                             (void **) &swap_orig)))
+        return;
+
+    expect("set_detour w/o SWAP", silkhook_set_detour(&g, (void *) swap_det_b),
+           SILKHOOK_ERR_STATE);
+    silkhook_unhook(&g);
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * probes
+ *
+ * +4 is past the first instr,  before x0 gets used - cb rewrites the arg
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static void probe_cb(struct silkhook_pt_regs *regs, void *user)
+{
+    (*(int *) user)++;
+    regs->x0 = 10;
+}
+
+#ifdef SILKHOOK_GP_ONLY
+SILKHOOK_GP_ONLY
+#endif
+static void probe_nofp_cb(struct silkhook_pt_regs *regs, void *user)
+{
+    (*(int *) user)++;
+    regs->x0 += 1;
+}
+
+static void test_probe(void)
+{
+    struct silkhook_opts o = { .flags = SILKHOOK_OPT_NOFP };
+    struct silkhook_hook h;
+    int hits = 0;
+    int i;
+
+    printf("silkhook: probe\n");
+    if (hook_ok("probe", silkhook_probe_at((uint8_t *) probe_fn + 4, probe_cb, &hits, &h)))
+    {
+        for (i = 0; i < 3; i++)
+            expect("x0 rewritten", probe_ptr(i), 31);
+
+        expect("hits", hits, 3);
+
+        silkhook_unhook(&h);
+        expect("unhooked", probe_ptr(2), 7);
+    }
+
+    hits = 0;
+    if (!hook_ok("nofp probe", silkhook_probe_at_ex((uint8_t *) probe_nofp_fn + 4,
+                                                    probe_nofp_cb, &hits, &h, &o)))
+        return;
+
+    expect("x0 bumped", probe_nofp_ptr(2), 16);
+    expect("hits", hits, 1);
+
+    silkhook_unhook(&h);
+    expect("unhooked", probe_nofp_ptr(2), 11);
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * sampling
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static fn_t samp_orig;
+static int  samp_hits;
+
+SILKHOOK_FUNC int samp_det(int x) { samp_hits++; return samp_orig(x); }
+
+static void test_sample(void)
+{
+    struct silkhook_opts o = { .flags = SILKHOOK_OPT_SAMPLED,  .period = 8 };
+    struct silkhook_hook h;
+    int i;
+
+    printf("silkhook: sample\n");
+    if (!hook_ok("hook", silkhook_hook_ex((void *) samp_fn, (void *) samp_det, &h,
+                                          (void **) &samp_orig, &o)))
+        return;
+
+    samp_ptr(0);
+    expect("first call sampled", samp_hits, 1);
+
+    for (i = 0; i < 8000; i++)
+        if (samp_ptr(i) != i + 1)
+            fails++;
+
+    /*  ~1000 w/ the +-period/2 jitter  */
+    expect_in("1 in 8 of 8000", samp_hits - 1, 500, 2000);
+
+    silkhook_unhook(&h);
+    expect("bad period", silkhook_hook_ex((void *) samp_fn, (void *) samp_det, &h,
+                                          (void **) &samp_orig,
+                                          &(struct silkhook_opts) {
+                                              .flags = SILKHOOK_OPT_SAMPLED,  .period = 1 }),
+           SILKHOOK_ERR_INVAL);
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * arg predicates
+ *
+ * pred_eval() is the semantics from types.h in plain c.   every table is
+ * run over the cross product of vals[] in x0 - x3 and the detour's hit
+ * count compared against it call by call - that catches a bad clause
+ * fixup  (a failed term skipping to the wrong clause)  anywhere
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static uint64_t (*pred_orig)(uint64_t, uint64_t, uint64_t, uint64_t);
+static unsigned long pred_hits;
+
+SILKHOOK_FUNC
+uint64_t pred_det(uint64_t a, uint64_t b, uint64_t c, uint64_t d)
+{
+    pred_hits++;
+    return pred_orig(a, b, c, d);
+}
+
+static const uint64_t vals[] = {
+    0, 3, 7, 10, 20, 0x30, 63, 64, 129,
+    (uint64_t) -1, (uint64_t) -5, 0xdead00000007ull, 0x100000003ull,
+};
+
+#define N_VALS  (sizeof(vals) / sizeof(vals[0]))
+
+static int pred_term(const struct silkhook_pred *p, const uint64_t *x)
+{
+    uint64_t l = x[p->arg];
+    uint64_t r = (p->flags & SILKHOOK_PRED_REG) ? x[p->reg] : p->imm;
+    int64_t  sl = (int64_t) l,  sr = (int64_t) r;
+
+    if (p->flags & SILKHOOK_PRED_W)
+    {
+        l = (uint32_t) l;
+        r = (uint32_t) r;
+        sl = (int32_t) l;
+        sr = (int32_t) r;
+    }
+
+    switch (p->op)
+    {
+        case SILKHOOK_PRED_EQ:   return l == r;
+        case SILKHOOK_PRED_NE:   return l != r;
+        case SILKHOOK_PRED_LO:   return l <  r;
+        case SILKHOOK_PRED_LS:   return l <= r;
+        case SILKHOOK_PRED_HI:   return l >  r;
+        case SILKHOOK_PRED_HS:   return l >= r;
+        case SILKHOOK_PRED_LT:   return sl <  sr;
+        case SILKHOOK_PRED_LE:   return sl <= sr;
+        case SILKHOOK_PRED_GT:   return sl >  sr;
+        case SILKHOOK_PRED_GE:   return sl >= sr;
+        case SILKHOOK_PRED_ANY:  return (l & r) != 0;
+        case SILKHOOK_PRED_NONE: return (l & r) == 0;
+        case SILKHOOK_PRED_IN:   return l < p->imm && ((p->map[l / 64] >> (l % 64)) & 1);
+    }
+    return 0;
+}
+
+static int pred_eval(const struct silkhook_pred *p, uint32_t n, const uint64_t *x)
+{
+    int any = 0,  all = 1;
+    uint32_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (i && (p[i].flags & SILKHOOK_PRED_OR))
+        {
+            any |= all;
+            all = 1;
+        }
+        all &= pred_term(&p[i], x);
+    }
+    return any | all;
+}
+
+/*  returns the number of matching calls,  bumps fails on any mismatch  */
+static unsigned long pred_run(const struct silkhook_pred *p, uint32_t n)
+{
+    unsigned long want = 0,  bad = 0;
+    uint64_t x[4];
+    size_t a, b, c, d;
+
+    for (a = 0; a < N_VALS; a++)
+    for (b = 0; b < N_VALS; b++)
+    for (c = 0; c < N_VALS; c++)
+    for (d = 0; d < N_VALS; d++)
+    {
+        unsigned long before = pred_hits;
+        int m;
+
+        x[0] = vals[a];  x[1] = vals[b];  x[2] = vals[c];  x[3] = vals[d];
+        m = pred_eval(p, n, x);
+
+        if (pred_ptr(x[0], x[1], x[2], x[3]) != (x[0] ^ x[1] ^ x[2] ^ x[3]))
+            bad++;
+        if (pred_hits - before != (unsigned long) m)
+        {
+            if (!bad)
+                printf("silkhook:    first miss @ %#llx %#llx %#llx %#llx,  want %d\n",
+                       (unsigned long long) x[0], (unsigned long long) x[1],
+                       (unsigned long long) x[2], (unsigned long long) x[3], m);
+            bad++;
+        }
+        want += m;
+    }
+
+    expect("mismatched calls", (long long) bad, 0);
+    return want;
+}
+
+static int pred_hook(struct silkhook_hook *h, const struct silkhook_pred *p, uint32_t n)
+{
+    struct silkhook_opts o = { .n_pred = n,  .pred = p };
+
+    return hook_ok("hook", silkhook_hook_ex((void *) pred_fn, (void *) pred_det, h,
+                                            (void **) &pred_orig, &o));
+}
+
+static void test_pred(void)
+{
+    static uint64_t map[1];
+    static uint64_t map2[3];
+    struct silkhook_hook h;
+
+    /*  (x0 == 3 && x1 != 0)  ||  x0 in map  ||  (x0 < x1 && x1 >= 100)
+     *  ||  (u32) x0 == 7   */
+    const struct silkhook_pred t1[] = {
+        { SILKHOOK_PRED_EQ,  0,  0,  0,                                      3,    NULL },
+        { SILKHOOK_PRED_NE,  1,  0,  0,                                      0,    NULL },
+        { SILKHOOK_PRED_IN,  0,  0,  SILKHOOK_PRED_OR,                       64,   map  },
+        { SILKHOOK_PRED_LT,  0,  1,  SILKHOOK_PRED_OR | SILKHOOK_PRED_REG,   0,    NULL },
+        { SILKHOOK_PRED_GE,  1,  0,  0,                                      100,  NULL },
+        { SILKHOOK_PRED_EQ,  0,  0,  SILKHOOK_PRED_OR | SILKHOOK_PRED_W,     7,    NULL },
+    };
+
+    /*  (x1 > 5u && (x0 & 0x30))  ||  (s32) x2 <= (s32) x3
+     *  ||  (!(x0 & 0xff) && x2 in map2 && x3 != 9 && x1 <= 64u)   */
+    const struct silkhook_pred t2[] = {
+        { SILKHOOK_PRED_HI,   1,  0,  0,                                     5,    NULL },
+        { SILKHOOK_PRED_ANY,  0,  0,  0,                                     0x30, NULL },
+        { SILKHOOK_PRED_LE,   2,  3,  SILKHOOK_PRED_OR | SILKHOOK_PRED_REG |
+                                      SILKHOOK_PRED_W,                       0,    NULL },
+        { SILKHOOK_PRED_NONE, 0,  0,  SILKHOOK_PRED_OR,                      0xff, NULL },
+        { SILKHOOK_PRED_IN,   2,  0,  0,                                     130,  map2 },
+        { SILKHOOK_PRED_NE,   3,  0,  0,                                     9,    NULL },
+        { SILKHOOK_PRED_LS,   1,  0,  0,                                     64,   NULL },
+    };
+
+    printf("silkhook: predicates\n");
+
+    map[0] = 1ull << 10;
+    if (pred_hook(&h, t1, 6))
+    {
+        printf("silkhook:    t1,  map = { 10 }:  %lu hits\n", pred_run(t1, 6));
+
+        /*  map is read live - no re-hook  */
+        map[0] = (1ull << 20) | (1ull << 63);
+        printf("silkhook:    t1,  map = { 20, 63 }:  %lu hits\n", pred_run(t1, 6));
+
+        silkhook_unhook(&h);
+    }
+
+    map2[0] = 1ull << 3;
+    map2[1] = 1ull << 0;                    /*  64  */
+    map2[2] = 1ull << 1;                    /*  129 */
+    if (pred_hook(&h, t2, 7))
+    {
+        printf("silkhook:    t2:  %lu hits\n", pred_run(t2, 7));
+        silkhook_unhook(&h);
+    }
+
+    expect("IN w/o map", silkhook_hook_ex((void *) pred_fn, (void *) pred_det, &h,
+                                          (void **) &pred_orig,
+                                          &(struct silkhook_opts) {
+                                              .n_pred = 1,
+                                              .pred = &(struct silkhook_pred) {
+                                                  SILKHOOK_PRED_IN, 0, 0, 0, 64, NULL } }),
+           SILKHOOK_ERR_INVAL);
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * constant returns / fault injection
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static void test_return(void)
+{
+    struct silkhook_opts o = { .flags = SILKHOOK_OPT_SWAP };
+    struct silkhook_hook h;
+    int i, n = 0;
+
+    printf("silkhook: return\n");
+    if (hook_ok("hook_return", silkhook_hook_return((void *) ret_fn, 42, &h, &o)))
+    {
+        expect("constant", ret_ptr(1), 42);
+
+        silkhook_set_return(&h, (uint64_t) -1);
+        expect("set_return", ret_ptr(1), -1);
+
+        silkhook_unhook(&h);
+        expect("unhooked", ret_ptr(1), 2);
+    }
+
+    if (hook_ok("hook_return", silkhook_hook_return((void *) ret_fn, 42, &h, NULL)))
+    {
+        expect("set_return w/o SWAP", silkhook_set_return(&h, 7), SILKHOOK_ERR_STATE);
+        silkhook_unhook(&h);
+    }
+
+    printf("silkhook: fail\n");
+    if (!hook_ok("hook_fail", silkhook_hook_fail((void *) fail_fn, (uint64_t) -11, 4, &h)))
+        return;
+
+    expect("first call fails", fail_ptr(0), -11);
+
+    for (i = 0; i < 4000; i++)
+        n += fail_ptr(i) == -11;
+
+    expect_in("1 in 4 of 4000", n, 500, 2000);
+
+    silkhook_unhook(&h);
+    expect("unhooked", fail_ptr(1), 2);
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * thread masks
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static fn_t thread_orig;
+
+SILKHOOK_FUNC int thread_det(int x) { return thread_orig(x) + 1000; }
+
+static void *thread_main(void *arg)
+{
+    int *r = arg;
+
+    r[0] = thread_ptr(1);
+    silkhook_thread_enable(1ull << 2);
+    r[1] = thread_ptr(1);
+    return NULL;
+}
+
+static void test_thread(void)
+{
+    struct silkhook_opts o = { .flags = SILKHOOK_OPT_THREAD,  .group = 2 };
+    struct silkhook_hook h;
+    pthread_t t;
+    int r[2] = { 0, 0 };
+
+    printf("silkhook: thread\n");
+    if (!hook_ok("hook", silkhook_hook_ex((void *) thread_fn, (void *) thread_det, &h,
+                                          (void **) &thread_orig, &o)))
+        return;
+
+    expect("mask 0", thread_ptr(1), 2);
+
+    silkhook_thread_enable(1ull << 2);
+    expect("mask bit 2", thread_ptr(1), 1002);
+
+    /*  masks r per thread,  a new one starts w/ none  */
+    pthread_create(&t, NULL, thread_main, r);
+    pthread_join(t, NULL);
+    expect("new thread",        r[0], 2);
+    expect("new thread enabled", r[1], 1002);
+
+    silkhook_thread_enable(0);
+    expect("mask cleared", thread_ptr(1), 2);
+
+    silkhook_unhook(&h);
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * epoch
+ *
+ * unhook only retires the code.   it's freed once this thread  (the only
+ * one that made EPOCH calls)  finishes another EPOCH call - tick_fn's
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static fn_t epoch_orig;
+static fn_t tick_orig;
+
+SILKHOOK_FUNC int epoch_det(int x) { return epoch_orig(x) + 1000; }
+SILKHOOK_FUNC int tick_det(int x)  { return tick_orig(x) + 1000; }
+
+static void test_epoch(void)
+{
+    struct silkhook_opts o = { .flags = SILKHOOK_OPT_EPOCH };
+    struct silkhook_hook h, tick;
+    size_t left;
+    int i;
+
+    printf("silkhook: epoch\n");
+    if (!hook_ok("hook", silkhook_hook_ex((void *) epoch_fn, (void *) epoch_det, &h,
+                                          (void **) &epoch_orig, &o)))
+        return;
+
+    if (!hook_ok("tick hook", silkhook_hook_ex((void *) tick_fn, (void *) tick_det, &tick,
+                                               (void **) &tick_orig, &o)))
+    {
+        silkhook_unhook(&h);
+        return;
+    }
+
+    for (i = 0; i < 4; i++)
+        expect("detour", epoch_ptr(i), i + 1001);
+
+    silkhook_unhook(&h);
+    expect("unhooked", epoch_ptr(1), 2);
+
+    left = silkhook_reclaim();
+    printf("silkhook:    retired,  %zu left\n", left);
+
+    for (i = 0; i < 8 && left; i++)
+    {
+        expect("tick", tick_ptr(1), 1002);
+        left = silkhook_reclaim();
+    }
+
+    expect("left after ticks", (long long) left, 0);
+
+    silkhook_unhook(&tick);
+}
+
+#endif /* __aarch64__ */
+
+
+int main(void)
+{
+    int r;
+
+    printf("silkhook: loaded !!!\n");
+
+    #ifndef __aarch64__
+    printf("silkhook: entry stubs r arm64 only,  nothing to do\n");
+    (void) r;
+    return 0;
+    #else
+    r = silkhook_init();
+    if (r != SILKHOOK_OK)
+    {
+        printf("silkhook: init failure: %s\n", silkhook_strerror(r));
+        return 1;
+    }
+
+    test_gate();
+    test_swap();
+    test_probe();
+    test_sample();
+    test_pred();
+    test_return();
+    test_thread();
+    test_epoch();
+
+    silkhook_shutdown();
+
+    printf("silkhook: %d mismatch%s\n", fails, fails == 1 ? "" : "es");
+    printf("silkhook: unloaded !!!\n");
+    return fails ? 1 : 0;
+    #endif
+}
@@ -43,6 +43,11 @@
     silkhook_hook((void *)(target), (void *)__sh_detour_##name, \
                   &__sh_hook_##name, (void **)&__sh_orig_##name)
 
+/*  opts:  const struct silkhook_opts *,  e.g. a task filter  */
+#define SILKHOOK_INSTALL_EX(name, target, opts) \
+    silkhook_hook_ex((void *)(target), (void *)__sh_detour_##name, \
+                     &__sh_hook_##name, (void **)&__sh_orig_##name, (opts))
+
 #define SILKHOOK_UNINSTALL(name)    \
     silkhook_unhook(&__sh_hook_##name)
 
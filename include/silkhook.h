@@ -26,9 +26,24 @@ extern "C" {
  * ───────────────────────────────────────────────────────────────────────────── */
 
 int silkhook_init(void);
+
+/*  kernel:  unhooked code is freed after an rcu-tasks grace period,
+ *  from rcu callbacks in the module that built silkhook in.   a module
+ *  using it MUST call this in its exit path,  after its last unhook -
+ *  it waits for the pending frees,  w/o it they can run after the
+ *  module text is gone  */
 void silkhook_shutdown(void);
 
 
+/*  pick before creating hooks,  live trampolines keep the mode they were made in.
+ *  WXORX trampolines sit in MAP_SHARED memfds,  so picking it also installs
+ *  the atfork handlers  (userspace) - a fork child gets private copies
+ *  instead of writing the parent's code.   a child that can't get them
+ *  faults on its next trampoline write  */
+int silkhook_set_mem_mode(enum silkhook_mem_mode mode);
+int silkhook_set_patch_backend(enum silkhook_patch_backend backend);
+
+
 /* ─────────────────────────────────────────────────────────────────────────────
  * core hook API
  * ───────────────────────────────────────────────────────────────────────────── */
@@ -46,6 +61,201 @@ int silkhook_enable(struct silkhook_hook *h);
 int silkhook_disable(struct silkhook_hook *h);
 int silkhook_destroy(struct silkhook_hook *h);
 
+/*  opts may be NULL  (== silkhook_create / silkhook_hook)  */
+int silkhook_create_ex(void *targ, void *detour, struct silkhook_hook *h, void **orig,
+                       const struct silkhook_opts *opts);
+int silkhook_hook_ex(void *targ, void *detour, struct silkhook_hook *h, void **orig,
+                     const struct silkhook_opts *opts);
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * kill switch  (arm64)
+ *
+ * hooks created w/ SILKHOOK_OPT_GATED check bit `group` of one global
+ * word on entry.   flipping it is a single atomic store - no text write,
+ * no icache flush,  no stop_machine:
+ *
+ *   silkhook_disable_all_fast();            <- every gated hook -> orig
+ *   silkhook_group_enable(3, true);         <- bring group 3 back
+ *
+ * ungated hooks aren't affected.   all groups start enabled
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+void silkhook_disable_all_fast(void);
+void silkhook_enable_all_fast(void);
+int silkhook_group_enable(unsigned group, bool on);
+uint64_t silkhook_gates(void);
+
+
+#ifndef __KERNEL__
+/* ─────────────────────────────────────────────────────────────────────────────
+ * thread masks  (arm64)
+ *
+ * hooks created w/ SILKHOOK_OPT_THREAD only run their detour on threads
+ * whose mask has bit `group` set,  the rest pay a tls load + tbz:
+ *
+ *   silkhook_hook_ex(targ, det, &h, &orig, &(struct silkhook_opts) {
+ *       .flags = SILKHOOK_OPT_THREAD,  .group = 2 });
+ *   ...
+ *   silkhook_thread_enable(1ull << 2);      <- on the traced thread
+ *
+ * masks start at 0 in every thread.   w/ GATED too,  both bits must be set
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+void silkhook_thread_enable(uint64_t mask);
+uint64_t silkhook_thread_mask(void);
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * deferred free  (arm64)
+ *
+ * hooks created w/ SILKHOOK_OPT_EPOCH can be unhooked while other threads
+ * r still in the detour or the trampoline.   the stub counts each
+ * thread's calls in flight  (tls,  no atomics),  unhook puts the code
+ * on a retire list instead of unmapping it:
+ *
+ *   silkhook_unhook(&h);                    <- returns right away
+ *   ...
+ *   silkhook_reclaim();                     <- frees what's drained,
+ *                                              returns what's left
+ *
+ * every retire also runs a reclaim pass.   code is freed once each
+ * thread that ever made an EPOCH call has finished one since the unhook,
+ * or exited - an idle one holds it back.   nothing is freed w/o
+ * membarrier.   a thread's first EPOCH call is only tracked once it's
+ * registered,  unhooking during it isn't covered.
+ *
+ * detours see the stub,  not the caller,  as their return addr,  so they
+ * must not be unwound through:  no longjmp past one  (the thread then
+ * blocks all reclaim),  no c++ exceptions through one  (no unwind info,
+ * the process terminates).   h itself still has to outlive SWAP calls.
+ * calls nest EPOCH hooks up to 32 deep per thread,  deeper ones aren't
+ * tracked
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+size_t silkhook_reclaim(void);
+
+#endif /* __KERNEL__ */
+
+
+#ifdef __KERNEL__
+/* ─────────────────────────────────────────────────────────────────────────────
+ * task filters  (arm64 kernel)
+ *
+ * SILKHOOK_OPT_TGID hooks compare current's tgid against up to
+ * SILKHOOK_MAX_IDS ids compiled into the entry stub.   other tasks go
+ * to orig w/o ever reaching the detour:
+ *
+ *   u64 ids[] = { target_tgid };
+ *   silkhook_hook_ex(silkhook_ksym("vfs_read"), det, &h, &orig,
+ *       &(struct silkhook_opts) {
+ *           .flags = SILKHOOK_OPT_TGID,  .n_ids = 1,  .ids = ids });
+ *
+ * ids r copied at create,  re-create the hook to change them.   there's
+ * no cgroup filter:  current->cgroups is rcu-protected and the stub
+ * can't hold rcu,  filter on cgroup_id() in the detour instead
+ * ───────────────────────────────────────────────────────────────────────────── */
+#endif
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * probes  (arm64)
+ *
+ * cb(regs, user) on every hit of the instr @ addr,  anywhere in a
+ * function.   the instr becomes a b to a stub that spills the GP regs,
+ * calls cb,  reloads them,  runs the moved instr and b's back - no brk,
+ * no syscall per hit:
+ *
+ *   silkhook_probe_at(fn + 0x40, on_hit, NULL, &h);
+ *   ...
+ *   silkhook_unhook(&h);
+ *
+ * the stub spills v0 - v31  (or the z / p file at the live VL on sve
+ * cpus)  around cb too,  so any cb is safe.   a GP-only cb can skip that
+ * w/ SILKHOOK_OPT_NOFP - build it w/ -mgeneral-regs-only,  or mark it
+ * SILKHOOK_GP_ONLY  (gcc only,  undefined elsewhere).   the kernel only
+ * ever saves GP regs.
+ * the moved instr can't use x16 / x17 - they may be live mid function -
+ * so one that'd need a scratch reg to relocate  (a branch out of b reach
+ * of the stub,  an fp / simd literal load out of ldr reach)  gets
+ * SILKHOOK_ERR_INSTR.   snapshots skip probes
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int silkhook_probe_at(void *addr, silkhook_probe_fn cb, void *user, struct silkhook_hook *h);
+int silkhook_probe_at_ex(void *addr, silkhook_probe_fn cb, void *user, struct silkhook_hook *h,
+                         const struct silkhook_opts *opts);
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * detour swap  (arm64)
+ *
+ * hooks created w/ SILKHOOK_OPT_SWAP jump through h->detour instead of a
+ * literal in the patch,  so switching detours is one store-release:
+ *
+ *   silkhook_hook_ex(targ, det_a, &h, &orig, &(struct silkhook_opts) {
+ *       .flags = SILKHOOK_OPT_SWAP });
+ *   silkhook_set_detour(&h, det_b);         <- next call lands in det_b
+ *
+ * ERR_STATE for hooks created w/o SWAP.   the old detour may still be
+ * running on other threads when this returns
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int silkhook_set_detour(struct silkhook_hook *h, void *detour);
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * sampling  (arm64)
+ *
+ * hooks created w/ SILKHOOK_OPT_SAMPLED keep a countdown in thread-local
+ * (userspace)  or per-cpu  (kernel)  storage.   unsampled calls cost a
+ * load,  a decrement,  a store and a branch to orig:
+ *
+ *   silkhook_hook_ex(targ, det, &h, &orig, &(struct silkhook_opts) {
+ *       .flags = SILKHOOK_OPT_SAMPLED,  .period = 1000 });
+ *
+ * so det sees ~0.1% of calls.   ERR_NOMEM past SILKHOOK_MAX_SAMPLED live
+ * sampled hooks.   a thread's first call into each hook is always sampled
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * arg predicates  (arm64)
+ *
+ * opts.pred is compiled into the entry stub,  so calls the detour would
+ * just pass on never leave asm:
+ *
+ *   static uint64_t fds[16];                <- 1024 watched fds
+ *   struct silkhook_pred p[] = {
+ *       { SILKHOOK_PRED_IN,  0,  0,  SILKHOOK_PRED_W,  1024,  fds },
+ *   };
+ *   silkhook_hook_ex(write_fn, det, &h, &orig, &(struct silkhook_opts) {
+ *       .n_pred = 1,  .pred = p });
+ *
+ * det only sees write()s on fds whose bit is set,  and fds[] can change
+ * at any time.   p itself is only read by create.   ERR_INVAL on a bad
+ * term,  see types.h for the ops.   snapshots skip predicated hooks
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * constant returns / fault injection  (arm64)
+ *
+ * no detour - the entry stub itself does  mov x0, #value ; ret:
+ *
+ *   silkhook_hook_return(alloc_fn, 0, &h, NULL);        <- always NULL
+ *   silkhook_hook_fail(send_fn, -EAGAIN, 100, &h);      <- ~1 in 100
+ *
+ * hook_fail is hook_return w/ SILKHOOK_OPT_SAMPLED,  other opts combine
+ * as usual:  GATED makes inject / pass-through one gate store,  SWAP
+ * makes the value one store  (silkhook_set_return).   undo w/
+ * silkhook_unhook.   snapshots skip them
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int silkhook_hook_return(void *targ, uint64_t value, struct silkhook_hook *h,
+                         const struct silkhook_opts *opts);
+int silkhook_hook_fail(void *targ, uint64_t value, uint32_t n, struct silkhook_hook *h);
+int silkhook_set_return(struct silkhook_hook *h, uint64_t value);
+
 
 /* ─────────────────────────────────────────────────────────────────────────────
  * batch API
@@ -55,6 +265,65 @@ int silkhook_hook_batch(struct silkhook_desc *descs, size_t n, struct silkhook_h
 int silkhook_unhook_batch(struct silkhook_hook *hooks, size_t n);
 
 
+/* ─────────────────────────────────────────────────────────────────────────────
+ * fork / cow
+ *
+ * patched text + trampoline pages go private per process.   hooks set
+ * up before fork r shared cow w/ the children,  ones set up after cost
+ * each child its own copies.   to keep that small:
+ *
+ *   silkhook_set_tramp_layout(SILKHOOK_TRAMP_PACKED);   <- one run of pages
+ *   silkhook_hook_batch(...);                           <- one write per page
+ *   silkhook_page_stats(&st);                           <- what it cost
+ *
+ * atfork_install keeps a fork racing a hook from leaving the child w/
+ * held locks  (userspace,  idempotent)
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int silkhook_set_tramp_layout(enum silkhook_tramp_layout layout);
+int silkhook_page_stats(struct silkhook_page_stats *st);
+
+#ifndef __KERNEL__
+int silkhook_atfork_install(void);
+#endif
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * call-site rewrite  (arm64)
+ *
+ *   before:   caller: bl targ ──> targ: ldr x16 / br x16 ──> detour
+ *   after:    caller: bl detour            (or the hook's entry stub)
+ *
+ * scans [start, start + len) for bls to an enabled hook's targ and points
+ * the ones w/ detour in ±128 MB at it directly.   n gets the count
+ * rewritten.   disable / unhook put the original bls back.   callers no
+ * longer pass through the prologue,  so this only suits detours that
+ * don't care how they were reached.   the range must be code - a data
+ * word that decodes as bl targ would get rewritten too
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int silkhook_rewrite_calls(struct silkhook_hook *h, void *start, size_t len, size_t *n);
+
+#ifndef __KERNEL__
+/*  whole exec segment of a loaded module,  "" for the main exe  */
+int silkhook_rewrite_calls_mod(struct silkhook_hook *h, const char *mod, size_t *n);
+#endif
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * transactions
+ *
+ * hooks / trampolines written between begin and commit skip their own
+ * icache flush,  commit does one merged pass for all of them.   hooked
+ * code isn't safe to run until commit.   txs nest.   a tx belongs to
+ * the thread that began it,  other threads' writes meanwhile flush as
+ * if there were none
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int silkhook_tx_begin(void);
+int silkhook_tx_commit(void);
+
+
 /* ─────────────────────────────────────────────────────────────────────────────
  * query API
  * ───────────────────────────────────────────────────────────────────────────── */
@@ -70,6 +339,32 @@ static inline void *silkhook_get_trampoline(const struct silkhook_hook *h)
 }
 
 
+#ifndef __KERNEL__
+/* ─────────────────────────────────────────────────────────────────────────────
+ * snapshot / restore
+ *
+ * snapshot serialises every enabled hook as module + off,  restore
+ * re-installs them in a process w/ the same libs  (no symbol lookups,
+ * trampolines built first,  then every patch in one batched write +
+ * one flush pass).   hooks must hold the blob's hook count
+ *
+ *   size_t len, skipped;
+ *   silkhook_snapshot(NULL, 0, &len, NULL); <- ERR_NOMEM,  len = needed
+ *   silkhook_snapshot(buf, len, &len, &skipped);
+ *   ...
+ *   silkhook_restore(buf, len, hooks, n);
+ *
+ * probes,  ret hooks and predicated hooks can't be serialised.   they're
+ * left out and counted in *skipped  (may be NULL)  - non-zero means the
+ * restore won't bring back everything that's hooked now
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int silkhook_snapshot(void *buf, size_t cap, size_t *len, size_t *skipped);
+int silkhook_restore(const void *blob, size_t len, struct silkhook_hook *hooks, size_t n);
+
+#endif /* __KERNEL__ */
+
+
 #ifdef __KERNEL__
 /* ─────────────────────────────────────────────────────────────────────────────
  * kernel symbol resolution
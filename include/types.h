@@ -57,7 +57,8 @@
  * trampoline sizing:
  *      worst case per instr:  cbz -> inverted + abs jump = 5 instrs (20 bytes)
  *      4 hook instrs * 20 = 80 bytes + jump back (16) = 96 bytes
- *      round up to 128 just incase
+ *      round up to 128 just incase,  256 when over 64 bytes of it need
+ *      lits  (code and lits on separate lines)
  * ───────────────────────────────────────────────────────────────────────────── */
 
 #define SILKHOOK_INSTR_SIZE             4u
@@ -65,19 +66,23 @@
 #ifdef SILKHOOK_ARCH_ARM64
     #define SILKHOOK_HOOK_N_INSTR       4u
     #define SILKHOOK_HOOK_N_BYTE        16u
-    #define SILKHOOK_TRAMPOLINE_MAX     128u
+    #define SILKHOOK_TRAMPOLINE_MAX     256u
 #else /*  SILKHOOK_ARCH_ARM32  */
     #define SILKHOOK_HOOK_N_INSTR       3u
     #define SILKHOOK_HOOK_N_BYTE        12u
     #define SILKHOOK_TRAMPOLINE_MAX     64u
 #endif
 
+/*  layout assumption only  (lit pool placement),  cache maintenance
+ *  uses the real line sizes  */
+#define SILKHOOK_CACHE_LINE             64u
+
 #define SILKHOOK_SAFE_HOOK_N_INSTR      9u
 #define SILKHOOK_SAFE_HOOK_N_BYTE       (SILKHOOK_INSTR_SIZE * SILKHOOK_SAFE_HOOK_N_INSTR)
 
 
 /* ─────────────────────────────────────────────────────────────────────────────
- * pt_regs - register context for kernel hooks
+ * pt_regs - register context for probes / kernel hooks
  *
  * 272 bytes, 16-byte aligned
  *
@@ -88,31 +93,161 @@
  *                          = 272 bytes
  * ───────────────────────────────────────────────────────────────────────────── */
 
-// #ifdef SILKHOOK_ARCH_ARM64
+#ifdef SILKHOOK_ARCH_ARM64
 
-// struct silkhook_pt_regs {
-//     uint64_t  x0,  x1,  x2,  x3,  x4,  x5,  x6,  x7;
-//     uint64_t  x8,  x9, x10, x11, x12, x13, x14, x15;
-//     uint64_t x16, x17, x18, x19, x20, x21, x22, x23;
-//     uint64_t x24, x25, x26, x27, x28, x29,      x30;
+struct silkhook_pt_regs {
+    uint64_t  x0,  x1,  x2,  x3,  x4,  x5,  x6,  x7;
+    uint64_t  x8,  x9, x10, x11, x12, x13, x14, x15;
+    uint64_t x16, x17, x18, x19, x20, x21, x22, x23;
+    uint64_t x24, x25, x26, x27, x28, x29,      x30;
 
-//     uint64_t sp;
-//     uint64_t pc;
-//     uint64_t pstate;
-// };
+    uint64_t sp;
+    uint64_t pc;
+    uint64_t pstate;
+};
 
-// #define SILKHOOK_PT_REGS_SIZE       272u
+#define SILKHOOK_PT_REGS_SIZE       272u
 
-// #else /*  SILKHOOK_ARCH_ARM32  */
+#else /*  SILKHOOK_ARCH_ARM32  */
 
-// struct silkhook_pt_regs {
-//     uint32_t r0, r1,  r2, r3, r4, r5, r6, r7;
-//     uint32_t r8, r9, r10, fp, ip, sp,     lr;
-// };
+struct silkhook_pt_regs {
+    uint32_t r0, r1,  r2, r3, r4, r5, r6, r7;
+    uint32_t r8, r9, r10, fp, ip, sp,     lr;
+};
 
-// #define SILKHOOK_PT_REGS_SIZE       60u
+#define SILKHOOK_PT_REGS_SIZE       60u
 
-// #endif
+#endif
+
+/*  probe callback.   x0-x30 writes r reloaded on the way out,  sp / pc
+ *  aren't   */
+typedef void (*silkhook_probe_fn)(struct silkhook_pt_regs *regs, void *user);
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * arg predicates  (arm64)
+ *
+ * compiled into the entry stub,  calls that don't match go straight to
+ * orig w/o entering the detour.   terms test one of x0 - x7 against an
+ * imm or another arg reg,  they AND together and PRED_OR starts a new
+ * clause:
+ *
+ *   { EQ,  0,  .imm = 3 },  { NE,  1,  .imm = 0 },  { IN,  0,  .flags = OR,  ... }
+ *
+ *   ==  (x0 == 3 && x1 != 0)  ||  x0 in map
+ *
+ *   LO .. HS:  unsigned,  LT .. GE:  signed
+ *   ANY:       (x & imm) != 0,   NONE:  (x & imm) == 0
+ *   IN:        x < imm  &&  bit x of map[] set.   map is read live,  so
+ *              flipping its bits changes what matches
+ *
+ * PRED_W compares only the low 32 bits - int args leave the top half
+ * undefined
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define SILKHOOK_PRED_EQ            0u
+#define SILKHOOK_PRED_NE            1u
+#define SILKHOOK_PRED_LO            2u
+#define SILKHOOK_PRED_LS            3u
+#define SILKHOOK_PRED_HI            4u
+#define SILKHOOK_PRED_HS            5u
+#define SILKHOOK_PRED_LT            6u
+#define SILKHOOK_PRED_LE            7u
+#define SILKHOOK_PRED_GT            8u
+#define SILKHOOK_PRED_GE            9u
+#define SILKHOOK_PRED_ANY           10u
+#define SILKHOOK_PRED_NONE          11u
+#define SILKHOOK_PRED_IN            12u
+
+#define SILKHOOK_PRED_REG           (1u << 0)   /*  rhs is x<reg>,  not imm     */
+#define SILKHOOK_PRED_W             (1u << 1)   /*  32-bit compare              */
+#define SILKHOOK_PRED_OR            (1u << 2)   /*  term opens a new clause     */
+
+#define SILKHOOK_MAX_PRED           8u
+
+struct silkhook_pred {
+    uint8_t         op;     /*  SILKHOOK_PRED_EQ ..               */
+    uint8_t         arg;    /*  0 .. 7                            */
+    uint8_t         reg;    /*  PRED_REG:  0 .. 7                 */
+    uint8_t         flags;  /*  SILKHOOK_PRED_REG | W | OR        */
+    uint64_t        imm;    /*  IN:  bits in map                  */
+    const uint64_t *map;    /*  IN:  must outlive the hook        */
+};
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * hook options
+ *
+ * anything set here routes the patched targ through a generated entry
+ * stub  (arm64)  instead of straight at the detour:
+ *
+ *   GATED:   the stub tests bit `group` of a global enable word first,
+ *            cleared means the call goes to orig.   see
+ *            silkhook_disable_all_fast()
+ *   SWAP:    the stub loads the detour from h->detour on every call
+ *            instead of branching to a fixed addr.   see
+ *            silkhook_set_detour()
+ *   THREAD:  the stub tests bit `group` of the calling thread's own
+ *            mask,  clear means orig.   threads start w/ none set,  see
+ *            silkhook_thread_enable()  (userspace)
+ *   TGID:    the stub reads current's tgid and compares it against
+ *            ids[],  no match means orig  (kernel)
+ *   EPOCH:   the stub counts calls in flight per thread,  unhook then
+ *            defers freeing the trampoline + stub until no thread can
+ *            still be in them.   detours must not be unwound through
+ *            (longjmp,  c++ exceptions).   see silkhook_reclaim()
+ *            (userspace)
+ *   SAMPLED: the detour runs on ~1 in `period` calls,  counted per
+ *            thread  (userspace)  or per cpu  (kernel).   the rest go
+ *            straight to orig.   the gap is jittered +-period/2 so
+ *            samples don't alias w/ periodic callers
+ *
+ * n_pred / pred  (see above)  also go through the stub,  checked after
+ * the gate and before the sample count
+ *
+ * probes  (silkhook_probe_at_ex):
+ *
+ *   by default the stub spills v0 - v31  (or the live-VL sve file)  +
+ *   fpsr around cb,  so cb may use fp / simd regs  (userspace).
+ *   NOFP:    skip the spill.   cb must then be general-regs-only,  see
+ *            SILKHOOK_GP_ONLY.   the kernel never spills,  its code is
+ *            general-regs-only already
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define SILKHOOK_OPT_GATED          (1u << 0)
+#define SILKHOOK_OPT_SWAP           (1u << 1)
+#define SILKHOOK_OPT_NOFP           (1u << 2)
+#define SILKHOOK_OPT_SAMPLED        (1u << 3)
+#define SILKHOOK_OPT_THREAD         (1u << 4)
+#define SILKHOOK_OPT_TGID           (1u << 5)
+#define SILKHOOK_OPT_EPOCH          (1u << 7)
+
+#define SILKHOOK_OPT_HOOK           (SILKHOOK_OPT_GATED | SILKHOOK_OPT_SWAP | \
+                                     SILKHOOK_OPT_SAMPLED | SILKHOOK_OPT_THREAD | \
+                                     SILKHOOK_OPT_TGID | SILKHOOK_OPT_EPOCH)
+#define SILKHOOK_OPT_PROBE          (SILKHOOK_OPT_NOFP)
+
+/*  gcc can enforce no fp / simd per function,  clang only per file
+ *  (-mgeneral-regs-only).   left undefined where it can't be enforced,
+ *  a NOFP cb marked w/ it then fails to build instead of going unchecked  */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__aarch64__)
+    #define SILKHOOK_GP_ONLY        __attribute__((target("general-regs-only")))
+#endif
+
+#define SILKHOOK_MAX_GROUPS         64u
+#define SILKHOOK_MAX_SAMPLED        64u     /*  live SAMPLED hooks  */
+#define SILKHOOK_MAX_PERIOD         (1u << 24)
+#define SILKHOOK_MAX_IDS            8u
+
+struct silkhook_opts {
+    uint32_t    flags;      /*  SILKHOOK_OPT_*                      */
+    uint32_t    group;      /*  GATED / THREAD:  < MAX_GROUPS       */
+    uint32_t    period;     /*  SAMPLED:  2 .. SILKHOOK_MAX_PERIOD  */
+    uint32_t    n_pred;     /*  <= SILKHOOK_MAX_PRED,  0 = none     */
+    const struct silkhook_pred *pred;   /*  only read by create     */
+    uint32_t    n_ids;      /*  TGID:  1 .. MAX_IDS                 */
+    const uint64_t *ids;    /*  only read by create                 */
+};
 
 
 /* ─────────────────────────────────────────────────────────────────────────────
@@ -124,9 +259,11 @@
  *           (call orig)
  * ───────────────────────────────────────────────────────────────────────────── */
 
+struct silkhook_callsites;
+
 struct silkhook_hook {
     uintptr_t   targ;
-    uintptr_t   detour;
+    uintptr_t   detour;         /*  SWAP:  read by the entry stub,  keep 8-byte aligned  */
     uintptr_t   trampoline;
 
     uint8_t     orig[SILKHOOK_HOOK_N_BYTE];
@@ -134,6 +271,25 @@ struct silkhook_hook {
 
     #ifdef SILKHOOK_ARCH_ARM32
         uint8_t is_thumb;
+    #else
+        bool      guarded;      /*  targ page enforces bti  */
+        uintptr_t veneer;       /*  far detour hop for short patches,  0 if none  */
+        bool      chained;      /*  targ was a foreign stub,  trampoline is its dest  */
+        bool      probe;        /*  mid function probe,  detour = trampoline = its stub  */
+        bool      ret;          /*  constant return,  no detour  */
+        uint64_t  retval;       /*  ret:  x0 the stub hands back,  read per call w/ SWAP  */
+    #endif
+
+    void        **orig_ptr;     /*  where *orig was stored,  for snapshots  */
+
+    struct silkhook_opts opts;
+    uintptr_t   entry;          /*  entry stub,  0 if targ jumps to detour  */
+    uint32_t    sample;         /*  SAMPLED:  countdown slot + 1,  0 if none  */
+
+    struct silkhook_callsites *sites;   /*  bls re-targeted at detour  */
+
+    #ifdef __KERNEL__
+        void    *deferred;      /*  rcu record release queues the code on  */
     #endif
 
     bool        active;
@@ -152,4 +308,56 @@ struct silkhook_desc {
 };
 
 
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * memory mode  (userspace)
+ *
+ *   RWX:    trampolines mapped rwx,  targs patched via mprotect
+ *   WXORX:  trampolines in a memfd mapped twice  (rw alias + rx alias),
+ *           targs patched via /proc/self/mem - no prot is ever flipped
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+enum silkhook_mem_mode {
+    SILKHOOK_MEM_RWX    = 0,
+    SILKHOOK_MEM_WXORX  = 1,
+};
+
+/*  how targs get patched  (userspace,  WXORX forces PROCMEM,  back to
+ *  RWX restores the last one picked):
+ *
+ *   MPROTECT:  mprotect rwx -> memcpy -> mprotect rx
+ *              2x mmap_lock for write,  splits / merges vmas
+ *   PROCMEM:   pwrite /proc/self/mem,  forced cow write
+ *              no vma changes,  mmap_lock only taken for read  */
+enum silkhook_patch_backend {
+    SILKHOOK_PATCH_MPROTECT = 0,
+    SILKHOOK_PATCH_PROCMEM  = 1,
+};
+
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * fork / cow accounting
+ *
+ * a patched text page is a private anon page from then on.   patched
+ * before fork,  parent and children share it cow - patched after,  every
+ * process that patches pays its own copy:
+ *
+ *   private pages per process  ~  text_pages + tramp_pages
+ *
+ *   NEAR:    trampoline chunk per b reach window of the targs
+ *   PACKED:  one contiguous run,  jump backs may need an abs jmp
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+enum silkhook_tramp_layout {
+    SILKHOOK_TRAMP_NEAR     = 0,
+    SILKHOOK_TRAMP_PACKED   = 1,
+};
+
+struct silkhook_page_stats {
+    size_t  hooks;          /*  enabled hooks                          */
+    size_t  text_pages;     /*  distinct text pages they patch         */
+    size_t  tramp_pages;    /*  exec pages held by the trampoline pool */
+};
+
 #endif /* _SILKHOOK_TYPES_H_ */
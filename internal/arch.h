@@ -14,12 +14,14 @@
     #include <stdint.h>
 #endif
 
-#if defined(__ARM_FEATURE_PAC_DEFAULT) && !defined(__KERNEL__)
+/*  xpaclri lives in hint space - a nop w/o pauth,  so no build flag
+ *  or hwcap check is needed before stripping  */
+#ifdef __aarch64__
 static inline void *__strip_pac(void *ptr)
 {
-    void *stripped;
-    __asm__ volatile("xpaci %0" : "=r"(stripped) : "0"(ptr));
-    return stripped;
+    register void *lr __asm__("x30") = ptr;
+    __asm__ volatile("hint #7" : "+r"(lr));     /*  xpaclri  */
+    return lr;
 }
 #else
 #define __strip_pac(ptr) (ptr)
@@ -128,16 +130,46 @@ static inline void *__strip_pac(void *ptr)
 #define __LDR_LIT_OP        0x18000000u
 
 
+/* ─────────────────────────────────────────────────────────────────────────────
+ * indirect branch & exception generating
+ *
+ * BR/BLR/RET encoding:
+ * 1 1 0 1 0 1 1 0 0 | opc | 1 1 1 1 1 0 0 0 0 0 0 | Rn | 0 0 0 0 0
+ *                      ^
+ *                      └─ 00=BR, 01=BLR, 10=RET
+ *
+ * SVC/HVC/SMC/BRK/HLT encoding:
+ * 1 1 0 1 0 1 0 0 | opc | imm16 | op2 | LL
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define __BR_MASK           0xFFFFFC1Fu
+#define __BR_OP             0xD61F0000u
+#define __RET_OP            0xD65F0000u
+#define __EXC_MASK          0xFFE00000u     /*  opc too  */
+#define __BRK_OP            0xD4200000u
+#define __HLT_OP            0xD4400000u
+
+
 /* ─────────────────────────────────────────────────────────────────────────────
  * BTI  (ARMv8.5+)
  *
- * BTI-enabled code requires landing pads @ indirect branch targs:
- *   bti j  - valid targ for BR   (jump)
- *   bti c  - valid targ for BLR  (call)
- *   bti jc - valid for both j, c
+ * BTI-enabled code requires landing pads @ indirect branch targs.
+ * what a pad accepts depends on the branch that got there  (btype):
+ *
+ *   branch                          btype   bti c   bti j   bti jc  paciasp
+ *   br x16 / x17                    01        y       y       y       y
+ *   br xN  (from a guarded page)    11        -       y       y       -
+ *   blr xN                          10        y       -       y       y
+ *   b / bl / ret xN                 00        -  no pad needed  -
+ *
+ * so:
+ *   - trampolines / stubs r entered like functions   ->  bti c
+ *   - detours get reached by br x16                   ->  their own bti c /
+ *                                                         paciasp will do
+ *   - jmps back into the middle of orig code have no pad to land on,
+ *     b if in reach,  ret x16 otherwise  (__codebuf.bti)
  *
- * trampoline is called via BLR,  so we can use BTI_C.
- * on non-BTI devices these could decode as HINT  (nop)
+ * on non-BTI cpus these decode as hints  (nop)
  * ───────────────────────────────────────────────────────────────────────────── */
 
 /*  bti c  */
@@ -146,11 +178,28 @@ static inline void *__strip_pac(void *ptr)
 
 /*  bti j  */
 #define __BTI_J() \
-    (0xD50324DFu)
+    (0xD503249Fu)
 
 /* bti jc  */
 #define __BTI_JC() \
-    (0xD50324FFu)
+    (0xD50324DFu)
+
+/*  bti {,c,j,jc}  -  hint #32 / 34 / 36 / 38  */
+#define __IS_BTI(instr) \
+    (((instr) & 0xFFFFFF3Fu) == 0xD503241Fu)
+
+/*  paciasp / pacibsp  -  implicit bti c on function entry  */
+#define __PACIASP()     (0xD503233Fu)
+#define __PACIBSP()     (0xD503237Fu)
+
+#define __IS_PAC_SP(instr) \
+    ((instr) == __PACIASP() || (instr) == __PACIBSP())
+
+#define __IS_LANDING_PAD(instr) \
+    (__IS_BTI(instr) || __IS_PAC_SP(instr))
+
+#define __NOP() \
+    (0xD503201Fu)
 
 
 /* ─────────────────────────────────────────────────────────────────────────────
@@ -173,6 +222,11 @@ static inline void *__strip_pac(void *ptr)
 #define __BR(reg) \
     (0xD61F0000u | ((reg) << 5))
 
+/*  ret x<reg>  -  indirect jmp w/ btype 00,  lands anywhere on a
+ *  guarded page  (costs a return stack mispredict)  */
+#define __RET_REG(reg) \
+    (0xD65F0000u | ((reg) << 5))
+
 /*  blr x<reg>  */
 #define __BLR(reg) \
     (0xD63F0000u | ((reg) << 5))
@@ -198,6 +252,11 @@ static inline void *__strip_pac(void *ptr)
 #define __MOVZ(reg, imm, shift) \
     (0xD2800000u | (((shift) / 16) << 21) | (((uint32_t)(imm) & 0xFFFF) << 5) | (reg))
 
+/*  movn x<reg>, #<imm16>, lsl #<shift>   (x = ~(imm << shift))
+ *  1 | 0 0 1 0 0 1 0 1 | hw | imm16 | Rd  */
+#define __MOVN(reg, imm, shift) \
+    (0x92800000u | (((shift) / 16) << 21) | (((uint32_t)(imm) & 0xFFFF) << 5) | (reg))
+
 /*  movk x<reg>, #<imm16>, lsl #<shift>
  *  1 | 1 1 1 0 0 1 0 1 | hw | imm16 | Rd
  *
@@ -214,11 +273,263 @@ static inline void *__strip_pac(void *ptr)
 #define __B(off) \
     (0x14000000u | (((off) >> 2) & 0x3FFFFFF))
 
+/*  bl <off>
+    * 1 0 0 1 0 1 | imm26  */
+#define __BL(off) \
+    (0x94000000u | (uint32_t) (((off) >> 2) & 0x3FFFFFF))
+
+/*  b / bl reach:  signed imm26 << 2  =  ±128 MB  */
+#define __B_RANGE   (1l << 27)
+#define __B_REACH(from, to) \
+    ((intptr_t) ((to) - (from)) >= -__B_RANGE && (intptr_t) ((to) - (from)) < __B_RANGE)
+
+/*  adrp x<reg>, <off>   (off = page delta in bytes)
+    * 1 | immlo | 10000 | immhi | Rd  */
+#define __ADRP(reg, off) \
+    (0x90000000u | (uint32_t) ((((off) >> 12) & 0x3) << 29) | (uint32_t) ((((off) >> 14) & 0x7FFFF) << 5) | (reg))
+
+/*  adr / ldr lit / b.cond / cbz reach  (imm19),  adrp reach  (imm21 << 12)  */
+#define __ADR_RANGE     (1ll << 20)
+#define __ADRP_RANGE    (1ll << 32)
+#define __IN_RANGE(d, r) \
+    ((int64_t) (d) >= -(int64_t) (r) && (int64_t) (d) < (int64_t) (r))
+
 /*  adr x<reg>, <off>
     * 0 | immlo | 10000 | immhi | Rd  */
 #define __ADR(reg, off) \
     (0x10000000u | ((((off) & 0x3) << 29)) | (((((off) >> 2) & 0x7FFFF) << 5)) | (reg))
 
+/*  b.<cond> <off>   (±1 MB)
+    * 0 1 0 1 0 1 0 0 | imm19 | 0 | cond  */
+#define __B_COND(cond, off) \
+    (__B_COND_OP | ((((off) >> 2) & 0x7FFFF) << 5) | (cond))
+
+#define __COND_EQ           0x0u
+#define __COND_NE           0x1u
+#define __COND_HS           0x2u
+#define __COND_LO           0x3u
+#define __COND_HI           0x8u
+#define __COND_LS           0x9u
+#define __COND_GE           0xAu
+#define __COND_LT           0xBu
+#define __COND_GT           0xCu
+#define __COND_LE           0xDu
+
+/*  cbz x<rt>, <off>   (±1 MB)  */
+#define __CBZ_X(rt, off) \
+    (0x80000000u | __CBZ_OP | ((((off) >> 2) & 0x7FFFF) << 5) | (rt))
+
+/*  cbnz x<rt>, <off>   (±1 MB)  */
+#define __CBNZ_X(rt, off) \
+    (0x80000000u | __CBNZ_OP | ((((off) >> 2) & 0x7FFFF) << 5) | (rt))
+
+/*  tbz / tbnz x<rt>, #<bit>, <off>   (±32 KB)
+    * b5 | 011011 | op | b40 | imm14 | Rt  */
+#define __TBZ(rt, bit, off) \
+    (__TBZ_OP | ((((uint32_t) (bit)) >> 5) << 31) | (((bit) & 0x1F) << 19) | ((((off) >> 2) & 0x3FFF) << 5) | (rt))
+
+#define __TBNZ(rt, bit, off) \
+    (__TBNZ_OP | ((((uint32_t) (bit)) >> 5) << 31) | (((bit) & 0x1F) << 19) | ((((off) >> 2) & 0x3FFF) << 5) | (rt))
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * load / store & data processing
+ *
+ * used by generated stubs to spill / reload register ctx
+ *
+ * reg 31 is sp as a base / add-sub operand,  xzr everywhere else
+ *
+ * STP/LDP (64-bit, signed offset):
+ * 1 0 1 0 1 0 0 1 0 | L | imm7 | Rt2 | Rn | Rt      (imm7 scaled by 8)
+ *
+ * STR/LDR (unsigned offset):
+ * 1 x 1 1 1 0 0 1 0 | L | imm12 | Rn | Rt          (imm12 scaled by size)
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define __REG_SP            31u
+#define __REG_XZR           31u
+
+/*  stp x<rt>, x<rt2>, [x<rn>, #<off>]  */
+#define __STP(rt, rt2, rn, off) \
+    (0xA9000000u | (((((off) >> 3) & 0x7F)) << 15) | ((rt2) << 10) | ((rn) << 5) | (rt))
+
+/*  ldp x<rt>, x<rt2>, [x<rn>, #<off>]  */
+#define __LDP(rt, rt2, rn, off) \
+    (0xA9400000u | (((((off) >> 3) & 0x7F)) << 15) | ((rt2) << 10) | ((rn) << 5) | (rt))
+
+/*  str x<rt>, [x<rn>, #<off>]  */
+#define __STR_X(rt, rn, off) \
+    (0xF9000000u | ((((off) >> 3) & 0xFFF) << 10) | ((rn) << 5) | (rt))
+
+/*  ldr x<rt>, [x<rn>, #<off>]  */
+#define __LDR_X(rt, rn, off) \
+    (0xF9400000u | ((((off) >> 3) & 0xFFF) << 10) | ((rn) << 5) | (rt))
+
+/*  str w<rt>, [x<rn>, #<off>]  */
+#define __STR_W(rt, rn, off) \
+    (0xB9000000u | ((((off) >> 2) & 0xFFF) << 10) | ((rn) << 5) | (rt))
+
+/*  ldr w<rt>, [x<rn>, #<off>]  */
+#define __LDR_W(rt, rn, off) \
+    (0xB9400000u | ((((off) >> 2) & 0xFFF) << 10) | ((rn) << 5) | (rt))
+
+/*  str x<rt>, [x<rn>, x<rm>, lsl #3]  */
+#define __STR_X_REG(rt, rn, rm) \
+    (0xF8207800u | ((rm) << 16) | ((rn) << 5) | (rt))
+
+/*  ldr x<rt>, [x<rn>, x<rm>, lsl #3]  */
+#define __LDR_X_REG(rt, rn, rm) \
+    (0xF8607800u | ((rm) << 16) | ((rn) << 5) | (rt))
+
+/*  add x<rd>, x<rn>, #<imm12>  */
+#define __ADD_IMM(rd, rn, imm) \
+    (0x91000000u | (((imm) & 0xFFF) << 10) | ((rn) << 5) | (rd))
+
+/*  sub x<rd>, x<rn>, #<imm12>  */
+#define __SUB_IMM(rd, rn, imm) \
+    (0xD1000000u | (((imm) & 0xFFF) << 10) | ((rn) << 5) | (rd))
+
+/*  add x<rd>, x<rn>, x<rm>  */
+#define __ADD_REG(rd, rn, rm) \
+    (0x8B000000u | ((rm) << 16) | ((rn) << 5) | (rd))
+
+/*  add w<rd>, w<rn>, #<imm12> {, lsl #12}  */
+#define __ADD_W_IMM(rd, rn, imm, lsl12) \
+    (0x11000000u | ((lsl12) ? (1u << 22) : 0) | (((imm) & 0xFFF) << 10) | ((rn) << 5) | (rd))
+
+/*  subs w<rd>, w<rn>, #<imm12>  */
+#define __SUBS_W_IMM(rd, rn, imm) \
+    (0x71000000u | (((imm) & 0xFFF) << 10) | ((rn) << 5) | (rd))
+
+/*  cmp x<rn> / w<rn>, #<imm12> {, lsl #12}  */
+#define __CMP_IMM(rn, imm, lsl12) \
+    (0xF100001Fu | ((lsl12) ? (1u << 22) : 0) | (((imm) & 0xFFF) << 10) | ((rn) << 5))
+
+#define __CMP_W_IMM(rn, imm, lsl12) \
+    (0x7100001Fu | ((lsl12) ? (1u << 22) : 0) | (((imm) & 0xFFF) << 10) | ((rn) << 5))
+
+/*  cmp x<rn>, x<rm>  /  w<rn>, w<rm>  */
+#define __CMP_REG(rn, rm) \
+    (0xEB00001Fu | ((rm) << 16) | ((rn) << 5))
+
+#define __CMP_W_REG(rn, rm) \
+    (0x6B00001Fu | ((rm) << 16) | ((rn) << 5))
+
+/*  tst x<rn>, x<rm>  /  w<rn>, w<rm>  */
+#define __TST_REG(rn, rm) \
+    (0xEA00001Fu | ((rm) << 16) | ((rn) << 5))
+
+#define __TST_W_REG(rn, rm) \
+    (0x6A00001Fu | ((rm) << 16) | ((rn) << 5))
+
+/*  tst x<rn>, #1  */
+#define __TST_1(rn) \
+    (0xF240001Fu | ((rn) << 5))
+
+/*  lsr x<rd>, x<rn>, #<sh>  /  w<rd>, w<rn>, #<sh>  */
+#define __LSR_IMM(rd, rn, sh) \
+    (0xD340FC00u | ((sh) << 16) | ((rn) << 5) | (rd))
+
+#define __LSR_W_IMM(rd, rn, sh) \
+    (0x53007C00u | ((sh) << 16) | ((rn) << 5) | (rd))
+
+/*  lsr x<rd>, x<rn>, x<rm>   (shift mod 64)  */
+#define __LSRV(rd, rn, rm) \
+    (0x9AC02400u | ((rm) << 16) | ((rn) << 5) | (rd))
+
+/*  ubfx w<rd>, w<rn>, #<lsb>, #<width>  */
+#define __UBFX_W(rd, rn, lsb, width) \
+    (0x53000000u | ((lsb) << 16) | (((lsb) + (width) - 1) << 10) | ((rn) << 5) | (rd))
+
+/*  orr x<rd>, x<rn>, x<rm>  */
+#define __ORR(rd, rn, rm) \
+    (0xAA000000u | ((rm) << 16) | ((rn) << 5) | (rd))
+
+/*  mrs x<rt>, tpidr_el0 / tpidr_el1 / tpidr_el2   (thread ptr,  per-cpu
+ *  offset @ el1 / vhe el2)  */
+#define __MRS_TPIDR_EL0(rt) \
+    (0xD53BD040u | (rt))
+
+#define __MRS_TPIDR_EL1(rt) \
+    (0xD538D080u | (rt))
+
+#define __MRS_TPIDR_EL2(rt) \
+    (0xD53CD040u | (rt))
+
+/*  mrs x<rt>, sp_el0   (current task @ el1)  */
+#define __MRS_SP_EL0(rt) \
+    (0xD5384100u | (rt))
+
+/*  mrs x<rt>, cntvct_el0  */
+#define __MRS_CNTVCT(rt) \
+    (0xD53BE040u | (rt))
+
+/*  mrs x<rt>, nzcv  */
+#define __MRS_NZCV(rt) \
+    (0xD53B4200u | (rt))
+
+/*  msr nzcv, x<rt>  */
+#define __MSR_NZCV(rt) \
+    (0xD51B4200u | (rt))
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * fp / simd & sve spills
+ *
+ * STP/LDP (128-bit q,  signed offset):
+ * 1 0 1 0 1 1 0 1 0 | L | imm7 | Rt2 | Rn | Rt      (imm7 scaled by 16)
+ *
+ * SVE STR/LDR (vector / predicate,  mul vl):
+ * x 1 1 0 0 1 0 1 1 0 | imm9h | 0 1 0 | imm9l | Rn | Zt      (z)
+ * x 1 1 0 0 1 0 1 1 0 | imm9h | 0 0 0 | imm9l | Rn | 0 Pt    (p)
+ *   ^ 1=str,  0=ldr
+ *
+ * z offsets r in VL bytes,  p offsets in VL / 8
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/*  stp q<rt>, q<rt2>, [x<rn>, #<off>]  */
+#define __STP_Q(rt, rt2, rn, off) \
+    (0xAD000000u | (((((off) >> 4) & 0x7F)) << 15) | ((rt2) << 10) | ((rn) << 5) | (rt))
+
+/*  ldp q<rt>, q<rt2>, [x<rn>, #<off>]  */
+#define __LDP_Q(rt, rt2, rn, off) \
+    (0xAD400000u | (((((off) >> 4) & 0x7F)) << 15) | ((rt2) << 10) | ((rn) << 5) | (rt))
+
+/*  mrs / msr fpsr  */
+#define __MRS_FPSR(rt) \
+    (0xD53B4420u | (rt))
+
+#define __MSR_FPSR(rt) \
+    (0xD51B4420u | (rt))
+
+#define __SVE_IMM9(imm) \
+    (((((uint32_t) (imm) >> 3) & 0x3F) << 16) | (((uint32_t) (imm) & 0x7) << 10))
+
+/*  str / ldr z<zt>, [x<rn>, #<imm>, mul vl]  */
+#define __STR_Z(zt, rn, imm) \
+    (0xE5804000u | __SVE_IMM9(imm) | ((rn) << 5) | (zt))
+
+#define __LDR_Z(zt, rn, imm) \
+    (0x85804000u | __SVE_IMM9(imm) | ((rn) << 5) | (zt))
+
+/*  str / ldr p<pt>, [x<rn>, #<imm>, mul vl]  */
+#define __STR_P(pt, rn, imm) \
+    (0xE5800000u | __SVE_IMM9(imm) | ((rn) << 5) | (pt))
+
+#define __LDR_P(pt, rn, imm) \
+    (0x85800000u | __SVE_IMM9(imm) | ((rn) << 5) | (pt))
+
+/*  addvl x<rd>, x<rn>, #<imm>   (imm * VL bytes,  -32..31)  */
+#define __ADDVL(rd, rn, imm) \
+    (0x04205000u | ((rn) << 16) | (((uint32_t) (imm) & 0x3F) << 5) | (rd))
+
+/*  rdffr p<pd>.b  /  wrffr p<pn>.b  */
+#define __RDFFR(pd) \
+    (0x2519F000u | (pd))
+
+#define __WRFFR(pn) \
+    (0x25289000u | ((pn) << 5))
+
+
 /* ─────────────────────────────────────────────────────────────────────────────
  * multi-instr sequences
  *
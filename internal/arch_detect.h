@@ -33,7 +33,7 @@
     #define SILKHOOK_INSTR_SIZE         4u
     #define SILKHOOK_HOOK_N_INSTR       4u
     #define SILKHOOK_HOOK_N_BYTE        16u
-    #define SILKHOOK_TRAMPOLINE_MAX     128u
+    #define SILKHOOK_TRAMPOLINE_MAX     256u
 #endif
 
 #ifdef SILKHOOK_ARCH_ARM32
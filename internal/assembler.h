@@ -20,13 +20,42 @@
 
 /* ─────────────────────────────────────────────────────────────────────────────
  * code buffer
+ *
+ * 64-bit literals  (abs jmp targs)  r deferred,  not inlined after the
+ * br.   __codebuf_finalize() drops them in a pool @ a caller chosen
+ * word idx and fixes up the ldr imm19s,  so code and data can live in
+ * separate cache lines:
+ *
+ *   ┌──────────────────────────┐ <- line 0
+ *   │ ldr  x16, =lit0  ────────┼──┐
+ *   │ br   x16                 │  │
+ *   │ ...                      │  │
+ *   ├──────────────────────────┤ <- line 1
+ *   │ ...                      │  │
+ *   │ lit0: .quad targ    <────┼──┘
+ *   └──────────────────────────┘
+ *
+ *   NOTE: a codebuf w/ n_lits != 0 is broken until finalized
+ *
+ * bti set:  register jmps go out as ret x16 instead of br x16 - they
+ * land mid function on a guarded page,  where only btype 00 is allowed
  * ───────────────────────────────────────────────────────────────────────────── */
 
+#define __CODEBUF_MAX_LITS  8
+
+struct __codebuf_lit {
+    size_t      at;         /*  idx of the ldr referencing it  */
+    uint64_t    val;
+};
+
 struct __codebuf {
     uint32_t    *buf;
     size_t      cap;
     size_t      len;
     uintptr_t   pc;
+    size_t      n_lits;
+    struct __codebuf_lit lits[__CODEBUF_MAX_LITS];
+    int         bti;        /*  jmp targs r on a guarded page  */
 };
 
 #define __CODEBUF_INIT(cb, _buf, _cap, _pc) do { \
@@ -34,6 +63,8 @@ struct __codebuf {
     (cb)->cap = (_cap); \
     (cb)->len = 0; \
     (cb)->pc  = (_pc);  \
+    (cb)->n_lits = 0;   \
+    (cb)->bti = 0;      \
 } while (0)
 
 #define __CODEBUF_EMIT(cb, instr) do { \
@@ -46,12 +77,25 @@ struct __codebuf {
     __CODEBUF_EMIT((cb), (uint32_t)((addr) >> 32));         \
 } while (0)
 
+/*  back-patch an already emitted slot  (e.g. skip offsets)  */
+#define __CODEBUF_AT(cb, idx, instr) do { \
+    if ((idx) < (cb)->cap)                 \
+        (cb)->buf[(idx)] = (instr);        \
+} while (0)
+
 #define __CODEBUF_PC(cb) \
     ((cb)->pc + ((cb)->len * 4))
 
 #define __CODEBUF_SIZE(cb) \
     ((cb)->len * 4)
 
+#define __CODEBUF_LIT_SIZE(cb) \
+    ((cb)->n_lits * 8)
+
+/*  indirect jmp via reg,  see bti above  */
+#define __CODEBUF_JMP_REG(cb, reg) \
+    ((cb)->bti ? __RET_REG(reg) : __BR(reg))
+
 
 /* ─────────────────────────────────────────────────────────────────────────────
  * emitters
@@ -67,11 +111,14 @@ struct __codebuf {
 #define __EMIT_MOV64_OPT(cb, reg, imm) \
     __emit_mov64_opt((cb), (reg), (imm))
 
-#define __EMIT_ABS_JMP(cb, targ) do {  \
-    __CODEBUF_EMIT((cb), __LDR_LIT(16, 8)); \
-    __CODEBUF_EMIT((cb), __BR(16));    \
-    __CODEBUF_EMIT_ADDR((cb), (targ)); \
-} while (0)
+#define __EMIT_PCREL_ADDR(cb, reg, addr) \
+    __emit_pcrel_addr((cb), (reg), (addr))
+
+#define __EMIT_JMP(cb, targ) \
+    __emit_jmp((cb), (targ))
+
+#define __EMIT_ABS_JMP(cb, targ) \
+    __emit_abs_jmp((cb), (targ))
 
 #define __EMIT_SAFE_JMP(cb, targ) do { \
     __CODEBUF_EMIT((cb), __B(8));      \
@@ -87,23 +134,30 @@ struct __codebuf {
 
 static inline void __emit_mov64_opt(struct __codebuf *cb, unsigned reg, uint64_t imm)
 {
-    int first = 1;
+    int first = 1, ones = 0;
+    uint16_t fill;
     unsigned shift;
 
-    if (imm == 0)
+    /*  mostly-ones values  (small negatives)  start from movn instead  */
+    for (shift = 0; shift < 64; shift += 16)
+        ones += ((imm >> shift) & 0xFFFF) == 0xFFFF;
+    fill = ones > 1 ? 0xFFFF : 0;
+
+    if (imm == 0 || imm == ~(uint64_t) 0)
     {
-        __CODEBUF_EMIT(cb, __MOVZ(reg, 0, 0));
+        __CODEBUF_EMIT(cb, fill ? __MOVN(reg, 0, 0) : __MOVZ(reg, 0, 0));
         return;
     }
 
     for (shift = 0; shift < 64; shift += 16)
     {
         uint16_t chunk = (imm >> shift) & 0xFFFF;
-        if (chunk != 0)
+        if (chunk != fill)
         {
             if (first)
             {
-                __CODEBUF_EMIT(cb, __MOVZ(reg, chunk, shift));
+                __CODEBUF_EMIT(cb, fill ? __MOVN(reg, (uint16_t) ~chunk, shift)
+                                        : __MOVZ(reg, chunk, shift));
                 first = 0;
             }
             else {
@@ -113,5 +167,108 @@ static inline void __emit_mov64_opt(struct __codebuf *cb, unsigned reg, uint64_t
     }
 }
 
+/*  ldr x16, =targ ; br / ret x16  -  lit deferred to the pool,  inline once
+ *  the pool is full  */
+static inline void __emit_abs_jmp(struct __codebuf *cb, uint64_t targ)
+{
+    if (cb->n_lits < __CODEBUF_MAX_LITS)
+    {
+        cb->lits[cb->n_lits].at  = cb->len;
+        cb->lits[cb->n_lits].val = targ;
+        cb->n_lits++;
+
+        __CODEBUF_EMIT(cb, __LDR_LIT(16, 0));     /*  fixed up @ finalize  */
+        __CODEBUF_EMIT(cb, __CODEBUF_JMP_REG(cb, 16));
+        return;
+    }
+
+    __CODEBUF_EMIT(cb, __LDR_LIT(16, 8));
+    __CODEBUF_EMIT(cb, __CODEBUF_JMP_REG(cb, 16));
+    __CODEBUF_EMIT_ADDR(cb, targ);
+}
+
+/*  place the lit pool @ word idx `at`  (>= len,  8-byte aligned pc),
+ *  gap is zero filled  (udf).   returns total bytes,  0 if it won't fit  */
+static inline size_t __codebuf_finalize(struct __codebuf *cb, size_t at)
+{
+    size_t i;
+
+    if (!cb->n_lits)
+        return __CODEBUF_SIZE(cb);
+
+    if (at < cb->len || ((cb->pc + (at * 4)) & 7) ||
+        at + (cb->n_lits * 2) > cb->cap)
+        return 0;
+
+    for (i = cb->len; i < at; i++)
+        cb->buf[i] = 0;
+
+    for (i = 0; i < cb->n_lits; i++)
+    {
+        size_t slot = at + (i * 2);
+
+        cb->buf[slot]     = (uint32_t) (cb->lits[i].val & 0xFFFFFFFF);
+        cb->buf[slot + 1] = (uint32_t) (cb->lits[i].val >> 32);
+        cb->buf[cb->lits[i].at] = __LDR_LIT(16, (slot - cb->lits[i].at) * 4);
+    }
+
+    cb->len = at + (cb->n_lits * 2);
+    cb->n_lits = 0;
+    return __CODEBUF_SIZE(cb);
+}
+
+/*  reg = addr,  shortest form from the current pc:
+ *    adr   reg, addr                       ±1 MB
+ *    adrp  reg, addr ; add reg, lo12       ±4 GB
+ *    movz / movk                           anywhere  */
+static inline void __emit_pcrel_addr(struct __codebuf *cb, unsigned reg, uintptr_t addr)
+{
+    uintptr_t pc = __CODEBUF_PC(cb);
+    int64_t  off = (int64_t) (addr - pc);
+    int64_t  pg  = (int64_t) ((addr & ~(uintptr_t) 0xFFF) - (pc & ~(uintptr_t) 0xFFF));
+
+    if (__IN_RANGE(off, __ADR_RANGE))
+    {
+        __CODEBUF_EMIT(cb, __ADR(reg, off));
+        return;
+    }
+
+    if (__IN_RANGE(pg, __ADRP_RANGE))
+    {
+        __CODEBUF_EMIT(cb, __ADRP(reg, pg));
+        if (addr & 0xFFF)
+            __CODEBUF_EMIT(cb, __ADD_IMM(reg, reg, addr & 0xFFF));
+        return;
+    }
+
+    __emit_mov64_opt(cb, reg, addr);
+}
+
+/*  jmp to targ,  shortest form from the current pc  (clobbers x16):
+ *    b     targ                            ±128 MB
+ *    adrp  x16, targ ; add x16 ; br x16    ±4 GB
+ *    ldr   x16, [pc, #8] ; br x16 ; .quad  anywhere
+ *  (ret x16 for br x16 when cb->bti)  */
+static inline void __emit_jmp(struct __codebuf *cb, uintptr_t targ)
+{
+    uintptr_t pc = __CODEBUF_PC(cb);
+    int64_t  pg  = (int64_t) ((targ & ~(uintptr_t) 0xFFF) - (pc & ~(uintptr_t) 0xFFF));
+
+    if (__B_REACH(pc, targ))
+    {
+        __CODEBUF_EMIT(cb, __B(targ - pc));
+        return;
+    }
+
+    if (__IN_RANGE(pg, __ADRP_RANGE))
+    {
+        __EMIT_PCREL_ADDR(cb, 16, targ);
+        __CODEBUF_EMIT(cb, __CODEBUF_JMP_REG(cb, 16));
+        return;
+    }
+
+    __EMIT_ABS_JMP(cb, targ);
+}
+
 
 #endif /* _SILKHOOK_ASSEMBLER_H_ */
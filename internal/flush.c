@@ -0,0 +1,306 @@
+/*
+ * silkhook - miniature arm64 hooking lib
+ * flush.c  - deferred icache maintenance
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "flush.h"
+#include "../include/types.h"
+#include "../include/status.h"
+#include "../platform/memory.h"
+
+#ifdef __KERNEL__
+    #include <linux/spinlock.h>
+    #include <linux/sched.h>
+#else
+    #include <pthread.h>
+#endif
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * state
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static struct __flush_range __ranges[__FLUSH_MAX_RANGES];
+static size_t    __n_ranges = 0;
+static uintptr_t __owner    = 0;    /*  thread whose tx is batching  */
+static unsigned  __depth    = 0;    /*  its nesting,  0 = no tx  */
+static unsigned  __guests   = 0;    /*  txs other threads opened meanwhile  */
+static int       __sync_owed = 0;   /*  ranges cleaned early,  commit syncs  */
+
+#ifdef __KERNEL__
+    static DEFINE_SPINLOCK(__flush_lock);
+    #define __FLUSH_LOCK(f)     spin_lock_irqsave(&__flush_lock, (f))
+    #define __FLUSH_UNLOCK(f)   spin_unlock_irqrestore(&__flush_lock, (f))
+    #define __FLUSH_SELF()      ((uintptr_t) current)
+#else
+    static pthread_mutex_t __flush_lock = PTHREAD_MUTEX_INITIALIZER;
+    #define __FLUSH_LOCK(f)     ((void) (f), pthread_mutex_lock(&__flush_lock))
+    #define __FLUSH_UNLOCK(f)   ((void) (f), pthread_mutex_unlock(&__flush_lock))
+    #define __FLUSH_SELF()      ((uintptr_t) pthread_self())
+#endif
+
+/*  caller holds the lock  */
+#define __FLUSH_MINE()      (__depth && __owner == __FLUSH_SELF())
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * merge
+ *
+ * insertion sort by start  (n is small,  mostly already ordered),  then
+ * fold anything overlapping or within a cache line of the prev range
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static size_t __flush_merge(struct __flush_range *r, size_t n)
+{
+    size_t i, j, m = 0;
+
+    for (i = 1; i < n; i++)
+    {
+        struct __flush_range k = r[i];
+
+        for (j = i; j && r[j - 1].start > k.start; j--)
+            r[j] = r[j - 1];
+        r[j] = k;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (m && r[i].start <= r[m - 1].end + SILKHOOK_CACHE_LINE)
+        {
+            if (r[i].end > r[m - 1].end)
+                r[m - 1].end = r[i].end;
+        }
+        else {
+            r[m++] = r[i];
+        }
+    }
+
+    return m;
+}
+
+/*  up to __FLUSH_BATCH merged ranges off the table's tail,  under the
+ *  lock.   the caller flushes them after dropping it - the kernel's
+ *  sync is an ipi,  it can't go out w/ irqs off  */
+static size_t __flush_take(struct __flush_range *out)
+{
+    size_t n, i;
+
+    __n_ranges = __flush_merge(__ranges, __n_ranges);
+    n = __n_ranges < __FLUSH_BATCH ? __n_ranges : __FLUSH_BATCH;
+
+    __n_ranges -= n;
+    for (i = 0; i < n; i++)
+        out[i] = __ranges[__n_ranges + i];
+
+    return n;
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * public
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/*  the first thread in owns the tx.   others opening one meanwhile r
+ *  guests:  their writes flush right away,  as outside a tx,  so nothing
+ *  they write waits on a commit they don't control  */
+void __flush_tx_begin(void)
+{
+    unsigned long flags = 0;
+
+    __FLUSH_LOCK(flags);
+    if (!__depth)
+    {
+        __owner = __FLUSH_SELF();
+        __depth = 1;
+    }
+    else if (__owner == __FLUSH_SELF())
+        __depth++;
+    else
+        __guests++;
+    __FLUSH_UNLOCK(flags);
+}
+
+/*  dc / ic per batch w/ the lock dropped,  one sync for the lot.   the
+ *  owner keeps the tx until the table is drained,  so anyone writing
+ *  meanwhile flushes their own  */
+int __flush_tx_commit(void)
+{
+    struct __flush_range out[__FLUSH_BATCH];
+    unsigned long flags = 0;
+    size_t n;
+    int sync;
+
+    __FLUSH_LOCK(flags);
+
+    if (!__FLUSH_MINE())
+    {
+        if (!__guests)
+        {
+            __FLUSH_UNLOCK(flags);
+            return SILKHOOK_ERR_STATE;
+        }
+
+        __guests--;
+        __FLUSH_UNLOCK(flags);
+        return SILKHOOK_OK;
+    }
+
+    if (__depth > 1)
+    {
+        __depth--;
+        __FLUSH_UNLOCK(flags);
+        return SILKHOOK_OK;
+    }
+
+    sync = __sync_owed;
+    __sync_owed = 0;
+
+    while ((n = __flush_take(out)))
+    {
+        __FLUSH_UNLOCK(flags);
+        __flush_icache_clean(out, n);
+        sync = 1;
+        __FLUSH_LOCK(flags);
+    }
+
+    __depth = 0;
+    __owner = 0;
+    __FLUSH_UNLOCK(flags);
+
+    if (sync)
+        __flush_icache_sync();
+
+    return SILKHOOK_OK;
+}
+
+int __flush_tx_active(void)
+{
+    unsigned long flags = 0;
+    int active;
+
+    __FLUSH_LOCK(flags);
+    active = __FLUSH_MINE();
+    __FLUSH_UNLOCK(flags);
+
+    return active;
+}
+
+void __flush_code(void *addr, size_t len)
+{
+    struct __flush_range out[__FLUSH_BATCH];
+    unsigned long flags = 0;
+    size_t n;
+
+    __FLUSH_LOCK(flags);
+
+    if (!__FLUSH_MINE())
+    {
+        __FLUSH_UNLOCK(flags);
+        __flush_icache(addr, len);
+        return;
+    }
+
+    /*  still full after a merge:  clean a batch early,  the sync waits
+     *  for commit  (nothing in the tx is exec'd before it anyway)  */
+    while (__n_ranges == __FLUSH_MAX_RANGES)
+    {
+        __n_ranges = __flush_merge(__ranges, __n_ranges);
+        if (__n_ranges < __FLUSH_MAX_RANGES)
+            break;
+
+        n = __flush_take(out);
+        __FLUSH_UNLOCK(flags);
+        __flush_icache_clean(out, n);
+        __FLUSH_LOCK(flags);
+        __sync_owed = 1;
+    }
+
+    __ranges[__n_ranges].start = (uintptr_t) addr;
+    __ranges[__n_ranges].end   = (uintptr_t) addr + len;
+    __n_ranges++;
+
+    __FLUSH_UNLOCK(flags);
+}
+
+/*  clips recorded ranges to what's outside [start, end).   a merged
+ *  range can straddle it,  its tail gets a slot of its own - or w/ the
+ *  table full,  an early clean like __flush_code's  */
+void __flush_forget(uintptr_t start, uintptr_t end)
+{
+    struct __flush_range *r, tail;
+    unsigned long flags = 0;
+    size_t i = 0;
+
+    __FLUSH_LOCK(flags);
+
+    while (i < __n_ranges)
+    {
+        r = &__ranges[i];
+
+        if (r->start >= end || r->end <= start)
+        {
+            i++;
+            continue;
+        }
+
+        if (r->start < start && r->end > end)
+        {
+            tail.start = end;
+            tail.end   = r->end;
+            r->end     = start;
+
+            if (__n_ranges < __FLUSH_MAX_RANGES)
+            {
+                __ranges[__n_ranges++] = tail;
+                continue;
+            }
+
+            __FLUSH_UNLOCK(flags);
+            __flush_icache_clean(&tail, 1);
+            __FLUSH_LOCK(flags);
+            __sync_owed = 1;
+            i = 0;      /*  table may have changed  */
+        }
+        else if (r->start < start)
+            r->end = start;
+        else if (r->end > end)
+            r->start = end;
+        else
+            *r = __ranges[--__n_ranges];
+    }
+
+    __FLUSH_UNLOCK(flags);
+}
+
+#ifndef __KERNEL__
+void __flush_fork_lock(int take)
+{
+    if (take)
+        pthread_mutex_lock(&__flush_lock);
+    else
+        pthread_mutex_unlock(&__flush_lock);
+}
+
+/*  a tx owned by some other parent thread never commits in the child,
+ *  flush what it recorded and drop it.   guests went w/ their threads  */
+void __flush_fork_child(void)
+{
+    struct __flush_range out[__FLUSH_BATCH];
+    size_t n;
+
+    __guests = 0;
+
+    if (!__depth || __owner == __FLUSH_SELF())
+        return;
+
+    while ((n = __flush_take(out)))
+        __flush_icache_clean(out, n);
+    __flush_icache_sync();
+
+    __depth = 0;
+    __owner = 0;
+    __sync_owed = 0;
+}
+#endif
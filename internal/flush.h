@@ -0,0 +1,66 @@
+/*
+ * silkhook - miniature arm64 hooking lib
+ * flush.h  - deferred icache maintenance
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _SILKHOOK_FLUSH_H_
+#define _SILKHOOK_FLUSH_H_
+
+#ifdef __KERNEL__
+    #include <linux/types.h>
+#else
+    #include <stdint.h>
+    #include <stddef.h>
+#endif
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * flush transactions
+ *
+ * outside a tx __flush_code() flushes right away.   inside one it only
+ * records the range,  commit sorts + merges them and flushes the lot
+ * w/ one barrier pass:
+ *
+ *   begin
+ *     __flush_code(a, 16)     ┐
+ *     __flush_code(b, 32)     ├─ recorded
+ *     __flush_code(a+16, 16)  ┘
+ *   commit  ->  merge -> { [a, a+32), [b, b+32) }  ->  dc / dsb / ic / dsb / isb
+ *
+ * ranges closer than a cache line r merged too.   txs nest,  the
+ * outermost commit flushes.   if the range table fills up mid tx it's
+ * merged,  and a batch cleaned early if that doesn't free room - the
+ * cross-cpu sync is still left to commit.   nothing is flushed w/ the
+ * table lock held
+ *
+ * one thread owns the tx at a time.   begins from other threads while
+ * it's open don't batch,  their writes flush right away - a tx only
+ * ever delays code its own thread wrote
+ *
+ *   NOTE: code written inside a tx isn't safe to exec until commit
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define __FLUSH_MAX_RANGES  256
+#define __FLUSH_BATCH       32      /*  ranges flushed per lock drop  */
+
+void __flush_tx_begin(void);
+int  __flush_tx_commit(void);
+int  __flush_tx_active(void);
+
+void __flush_code(void *addr, size_t len);
+
+/*  [start, end) is about to be unmapped,  drop it from recorded ranges  */
+void __flush_forget(uintptr_t start, uintptr_t end);
+
+#ifndef __KERNEL__
+/*  pthread_atfork prepare  (take = 1)  /  parent + child  (take = 0)  */
+void __flush_fork_lock(int take);
+
+/*  pthread_atfork child,  under the fork locks  */
+void __flush_fork_child(void);
+#endif
+
+
+#endif /* _SILKHOOK_FLUSH_H_ */
@@ -8,71 +8,176 @@
 #include "relocator.h"
 #include "../include/status.h"
 
+#ifdef __KERNEL__
+    #include <linux/string.h>
+#else
+    #include <string.h>
+#endif
+
 
 /* ─────────────────────────────────────────────────────────────────────────────
  * relocation emitters
  *
- * b. cond / cbz / tbz have limited range,  so we invert the cond
- * and jump over an absolute branch to the orig targ
+ * everything is re-encoded against the new pc first,  pooled slots
+ * usually sit close enough that the instr survives as-is:
+ *
+ *   b / bl             ±128 MB   b / bl <new off>
+ *   b.cond / cbz / ldr ±1 MB     same instr,  new imm19
+ *   tbz                ±32 KB    same instr,  new imm14
+ *   adr                ±1 MB     adr
+ *   adrp               ±4 GB     adrp
+ *
+ * out of reach,  b. cond / cbz / tbz invert the cond and hop over a jmp
+ * to the orig targ  (__EMIT_JMP picks b / adrp+add+br / abs):
  *
  *   orig:                 reloc'd:
  *   ┌──────────────┐      ┌──────────────────────┐
  *   │ cbz x0, #off │      │ cbnz x0, #skip       │ <- invertd
- *   └──────────────┘      │ ldr  x16, [pc, #8]   │
+ *   └──────────────┘      │ adrp x16, targ       │
+ *                         │ add  x16, x16, lo12  │
  *                         │ br   x16             │
- *                         │ <targ_low>           │
- *                         │ <targ_high>          │
  *                         │ skip: ...            │ <- continue
  *                         └──────────────────────┘
  * ───────────────────────────────────────────────────────────────────────────── */
 
+#define __IMM19     0x7FFFFu
+#define __IMM14     0x3FFFu
+
+/*  re-point the pc-rel imm @ bit 5 to targ,  0 if out of reach  */
+static int __reloc_reenc(uint32_t instr, uint32_t mask, uintptr_t targ, struct __codebuf *cb)
+{
+    int64_t off = (int64_t) (targ - __CODEBUF_PC(cb)) >> 2;
+    int64_t lim = (int64_t) (mask >> 1) + 1;
+
+    if (off < -lim || off >= lim)
+        return 0;
+
+    __CODEBUF_EMIT(cb, (instr & ~(mask << 5)) | (((uint32_t) off & mask) << 5));
+    return 1;
+}
+
+/*  inv'd cond branch over a jmp to targ,  skip patched once the jmp is sized  */
+static void __reloc_inv_jmp(uint32_t inv, uint32_t mask, uintptr_t targ, struct __codebuf *cb)
+{
+    size_t at = cb->len;
+
+    __CODEBUF_EMIT(cb, inv);
+    __EMIT_JMP(cb, targ);
+    __CODEBUF_AT(cb, at, (inv & ~(mask << 5)) | (((uint32_t) (cb->len - at) & mask) << 5));
+}
+
 static void __reloc_b_cond(uint32_t instr, uintptr_t targ, struct __codebuf *cb)
 {
-    uint32_t inv = instr ^ 0x1;
-    uint32_t cond = inv  & 0xF;
-    uint32_t skip = __B_COND_OP | ((5 & 0x7FFFF) << 5) | cond;
-    __CODEBUF_EMIT(cb, skip);
-    __EMIT_ABS_JMP(cb, targ);
+    if (!__reloc_reenc(instr, __IMM19, targ, cb))
+        __reloc_inv_jmp(instr ^ 0x1, __IMM19, targ, cb);
 }
 
 static void __reloc_cb(uint32_t instr, uintptr_t targ, struct __codebuf *cb)
 {
-    uint32_t inv = instr ^ (1u << 24);
-    uint32_t sf  = inv   & (1u << 31);
-    uint32_t op  = inv   & (1u << 24);
-    uint32_t rt  = __RT(inv);
-    uint32_t skip = 0x34000000u | sf | op | ((5 & 0x7FFFF) << 5) | rt;
-    __CODEBUF_EMIT(cb, skip);
-    __EMIT_ABS_JMP(cb, targ);
+    if (!__reloc_reenc(instr, __IMM19, targ, cb))
+        __reloc_inv_jmp(instr ^ (1u << 24), __IMM19, targ, cb);
 }
 
 static void __reloc_tb(uint32_t instr, uintptr_t targ, struct __codebuf *cb)
 {
-    uint32_t inv = instr ^ (1u << 24);
-    uint32_t b5  = inv   & (1u << 31);
-    uint32_t op  = inv   & (1u << 24);
-    uint32_t b40 = inv   & (0x1F << 19);
-    uint32_t rt  = __RT(inv);
-    uint32_t skip = 0x36000000u | b5 | op | b40 | ((5 & 0x3FFF) << 5) | rt;
-    __CODEBUF_EMIT(cb, skip);
-    __EMIT_ABS_JMP(cb, targ);
+    if (!__reloc_reenc(instr, __IMM14, targ, cb))
+        __reloc_inv_jmp(instr ^ (1u << 24), __IMM14, targ, cb);
 }
 
+static void __reloc_bl(uintptr_t targ, struct __codebuf *cb)
+{
+    uintptr_t pc = __CODEBUF_PC(cb);
+    size_t at;
+
+    if (__B_REACH(pc, targ))
+    {
+        __CODEBUF_EMIT(cb, __BL(targ - pc));
+        return;
+    }
+
+    /*  adr x30, <past the jmp>  */
+    at = cb->len;
+    __CODEBUF_EMIT(cb, 0);
+    __EMIT_JMP(cb, targ);
+    __CODEBUF_AT(cb, at, __ADR(30, (cb->len - at) * 4));
+}
+
+static void __reloc_adrp(uint32_t instr, uintptr_t targ, struct __codebuf *cb)
+{
+    unsigned rd = __RD(instr);
+    int64_t  pg = (int64_t) (targ - (__CODEBUF_PC(cb) & ~(uintptr_t) 0xFFF));
+
+    if (__IN_RANGE(pg, __ADRP_RANGE))
+        __CODEBUF_EMIT(cb, __ADRP(rd, pg));
+    else
+        __EMIT_MOV64_OPT(cb, rd, targ);
+}
+
+/*  ldr (literal) -> ldr (unsigned imm),  indexed by opc  (V=0 / V=1)
+ *    gp:    ldr w      ldr x      ldrsw      prfm
+ *    simd:  ldr s      ldr d      ldr q      -         */
+static const uint32_t __ldr_uimm[2][4] = {
+    { 0xB9400000u, 0xF9400000u, 0xB9800000u, 0xF9800000u },
+    { 0xBD400000u, 0xFD400000u, 0x3DC00000u, 0           },
+};
+static const unsigned __ldr_scale[2][4] = {
+    { 2, 3, 2, 3 },
+    { 2, 3, 4, 0 },
+};
+
+/*  gp loads build the addr in rt itself - it's about to be overwritten
+ *  anyway.   simd loads and prfm  (rt is the prfop)  go through x16  */
 static void __reloc_ldr_lit(uint32_t instr, uintptr_t targ, struct __codebuf *cb)
 {
-    unsigned rt  = __RT(instr);
-    uint32_t opc = __OPC(instr);
-    uint32_t v   = __V(instr);
+    unsigned rt    = __RT(instr);
+    uint32_t opc   = __OPC(instr);
+    uint32_t v     = __V(instr);
+    uint32_t op    = __ldr_uimm[v][opc];
+    unsigned scale = __ldr_scale[v][opc];
+    unsigned base  = (v || opc == 3) ? 16 : rt;
+    uint32_t lo12  = targ & 0xFFF;
+    int64_t  pg;
+
+    if (__reloc_reenc(instr, __IMM19, targ, cb))
+        return;
 
-    __EMIT_MOV64_OPT(cb, 16, targ);
+    /*  unallocated,  nothing sane to rebuild  */
+    if (!op)
+    {
+        __CODEBUF_EMIT(cb, instr);
+        return;
+    }
 
-    if (v)
+    /*  adrp base ; ldr rt, [base, #lo12]  when lo12 scales  */
+    pg = (int64_t) ((targ & ~(uintptr_t) 0xFFF) - (__CODEBUF_PC(cb) & ~(uintptr_t) 0xFFF));
+    if (__IN_RANGE(pg, __ADRP_RANGE) && !(lo12 & ((1u << scale) - 1)))
     {
-        uint32_t sz = (opc == 0) ? 2   : (opc == 1) ? 3 : 4;
-        __CODEBUF_EMIT(cb, 0x3C400200u | (sz << 30) | (16 << 5) | rt);
+        __CODEBUF_EMIT(cb, __ADRP(base, pg));
+        __CODEBUF_EMIT(cb, op | ((lo12 >> scale) << 10) | (base << 5) | rt);
+        return;
     }
-    else {
-        __CODEBUF_EMIT(cb, (opc ?  0xF9400200u : 0xB9400200u) | (16 << 5) | rt);
+
+    __EMIT_PCREL_ADDR(cb, base, targ);
+    __CODEBUF_EMIT(cb, op | (base << 5) | rt);
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * branch targ decode  (0 if not a direct branch)
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static uintptr_t __branch_targ(uint32_t instr, uintptr_t pc)
+{
+    switch (__CLASSIFY(instr))
+    {
+    case INSTR_B:
+    case INSTR_BL:      return pc + __DEC_B(instr);
+    case INSTR_B_COND:  return pc + __DEC_B_COND(instr);
+    case INSTR_CBZ:
+    case INSTR_CBNZ:    return pc + __DEC_CB(instr);
+    case INSTR_TBZ:
+    case INSTR_TBNZ:    return pc + __DEC_TB(instr);
+    default:            return 0;
     }
 }
 
@@ -81,6 +186,51 @@ static void __reloc_ldr_lit(uint32_t instr, uintptr_t targ, struct __codebuf *cb
  * public
  * ───────────────────────────────────────────────────────────────────────────── */
 
+int __reloc_check(const uint32_t *src, size_t n, uintptr_t pc)
+{
+    uintptr_t end = pc + (n * 4);
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        uint32_t  instr = src[i];
+        uintptr_t targ  = __branch_targ(instr, pc + (i * 4));
+
+        /*  someone else's trap,  it'd fire from the wrong pc.   svc /
+         *  hvc / smc don't care where they run  */
+        if ((instr & __EXC_MASK) == __BRK_OP || (instr & __EXC_MASK) == __HLT_OP)
+            return SILKHOOK_ERR_INSTR;
+
+        if (targ > pc && targ < end)
+            return SILKHOOK_ERR_INSTR;
+
+        if (i + 1 < n && (__CLASSIFY(instr) == INSTR_B ||
+                          (instr & __BR_MASK) == __BR_OP ||
+                          (instr & __BR_MASK) == __RET_OP))
+            return SILKHOOK_ERR_INSTR;
+    }
+    return SILKHOOK_OK;
+}
+
+int __reloc_scan(const uint32_t *src, size_t n, uintptr_t pc, uintptr_t lo, uintptr_t hi)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        uint32_t  instr = src[i];
+        uintptr_t targ  = __branch_targ(instr, pc + (i * 4));
+
+        if (targ >= lo && targ < hi)
+            return SILKHOOK_ERR_INSTR;
+
+        /*  jump table,  could land anywhere  */
+        if ((instr & __BR_MASK) == __BR_OP)
+            return SILKHOOK_ERR_INSTR;
+    }
+    return SILKHOOK_OK;
+}
+
 int __reloc(uint32_t instr, uintptr_t pc, struct __codebuf *cb)
 {
     enum __instr_kind k = __CLASSIFY(instr);
@@ -93,12 +243,11 @@ int __reloc(uint32_t instr, uintptr_t pc, struct __codebuf *cb)
         break;
     case INSTR_B:
         targ = pc + __DEC_B(instr);
-        __EMIT_ABS_JMP(cb, targ);
+        __EMIT_JMP(cb, targ);
         break;
     case INSTR_BL:
         targ = pc + __DEC_B(instr);
-        __CODEBUF_EMIT(cb, __ADR(30, 8));
-        __EMIT_ABS_JMP(cb, targ);
+        __reloc_bl(targ, cb);
         break;
     case INSTR_B_COND:
         targ = pc + __DEC_B_COND(instr);
@@ -116,11 +265,11 @@ int __reloc(uint32_t instr, uintptr_t pc, struct __codebuf *cb)
         break;
     case INSTR_ADR:
         targ = pc + __DEC_ADR(instr);
-        __EMIT_MOV64_OPT(cb, __RD(instr), targ);
+        __EMIT_PCREL_ADDR(cb, __RD(instr), targ);
         break;
     case INSTR_ADRP:
         targ = (pc & ~0xFFFull) + __DEC_ADRP(instr);
-        __EMIT_MOV64_OPT(cb, __RD(instr), targ);
+        __reloc_adrp(instr, targ, cb);
         break;
     case INSTR_LDR_LIT:
         targ = pc + __DEC_LDR_LIT(instr);
@@ -129,3 +278,123 @@ int __reloc(uint32_t instr, uintptr_t pc, struct __codebuf *cb)
     }
     return SILKHOOK_OK;
 }
+
+/*  bytes of the stub @ src,  0 if it isn't one or runs past max.   a
+ *  literal has to sit in those bytes - one out in a data word can be
+ *  swapped under us by whoever owns it  */
+static size_t __stub_match(const uint32_t *src, uintptr_t pc, size_t max, uintptr_t *dest)
+{
+    size_t pad = 0;
+    uint32_t i0;
+    unsigned rt;
+
+    if (max < 4)
+        return 0;
+
+    if (__IS_BTI(src[0]))
+    {
+        pad = 1;
+        src++;
+        pc += 4;
+        max -= 4;
+    }
+
+    if (max < 4)
+        return 0;
+
+    i0 = src[0];
+    rt = __RT(i0);
+
+    if ((i0 & __B_MASK) == __B_OP)
+    {
+        *dest = pc + __DEC_B(i0);
+        return (pad + 1) * 4;
+    }
+
+    if ((rt != 16 && rt != 17) || max < 8)
+        return 0;
+
+    /*  ldr x (literal) ; br  */
+    if ((i0 & 0xFF000000u) == 0x58000000u && src[1] == __BR(rt))
+    {
+        uintptr_t lit = pc + __DEC_LDR_LIT(i0);
+        uint64_t  val;
+
+        if (lit < pc + 8 || lit + 8 > pc + max)
+            return 0;
+
+        memcpy(&val, src + (lit - pc) / 4, sizeof(val));
+        *dest = (uintptr_t) val;
+        return pad * 4 + (lit - pc + 8);
+    }
+
+    /*  adrp ; add x, x, #lo12  (64 bit,  no shift)  ; br  */
+    if (max >= 12 &&
+        __CLASSIFY(i0) == INSTR_ADRP &&
+        (src[1] & 0xFFC003FFu) == (0x91000000u | (rt << 5) | rt) &&
+        src[2] == __BR(rt))
+    {
+        *dest = (pc & ~(uintptr_t) 0xFFF) + __DEC_ADRP(i0) + ((src[1] >> 10) & 0xFFF);
+        return (pad + 3) * 4;
+    }
+
+    return 0;
+}
+
+/*  first hop only.   dest is wherever the stub goes,  we don't chase it -
+ *  nothing says the next stub's page is mapped,  or stays that way  */
+int __reloc_follow(const uint32_t *src, uintptr_t pc, size_t max, struct __reloc_stub *out)
+{
+    uintptr_t dest;
+
+    out->len = __stub_match(src, pc, max, &dest);
+    if (!out->len)
+        return 0;
+
+    out->dest = dest;
+    return 1;
+}
+
+/*  mid funct x16 / x17 may be live,  so only what needs no scratch reg:
+ *  branches in b reach,  adr / adrp and gp literal loads  (into rt).
+ *  an out of reach prfm is only a hint and gets dropped  */
+int __reloc_probe(uint32_t instr, uintptr_t pc, struct __codebuf *cb)
+{
+    enum __instr_kind k = __CLASSIFY(instr);
+    uintptr_t targ = __branch_targ(instr, pc);
+    uint32_t  mask = (k == INSTR_TBZ || k == INSTR_TBNZ) ? __IMM14 : __IMM19;
+
+    switch (k)
+    {
+    case INSTR_B:
+    case INSTR_BL:
+        if (!__B_REACH(__CODEBUF_PC(cb), targ))
+            return SILKHOOK_ERR_INSTR;
+        break;
+    case INSTR_B_COND:
+    case INSTR_CBZ:
+    case INSTR_CBNZ:
+    case INSTR_TBZ:
+    case INSTR_TBNZ:
+        if (__reloc_reenc(instr, mask, targ, cb))
+            return SILKHOOK_OK;
+        if (!__B_REACH(__CODEBUF_PC(cb) + 4, targ))
+            return SILKHOOK_ERR_INSTR;
+        break;
+    case INSTR_LDR_LIT:
+        if (__reloc_reenc(instr, __IMM19, pc + __DEC_LDR_LIT(instr), cb))
+            return SILKHOOK_OK;
+        if (__OPC(instr) == 3 && !__V(instr))
+        {
+            __CODEBUF_EMIT(cb, __NOP());
+            return SILKHOOK_OK;
+        }
+        if (__V(instr))
+            return SILKHOOK_ERR_INSTR;
+        break;
+    default:
+        break;
+    }
+
+    return __reloc(instr, pc, cb);
+}
@@ -66,7 +66,49 @@ enum __instr_kind {
 )
 
 
+/* ─────────────────────────────────────────────────────────────────────────────
+ * coverage check
+ *
+ * a run of instrs is only safe to move out of line if:
+ *   - none of them trap  (svc / brk / hlt ...  someone else's probe)
+ *   - no branch lands back inside the run  (that'd hit our patch)
+ *   - nothing but the last instr leaves for good  (b / br / ret),  code
+ *     after an unconditional exit is usually some other branch's targ
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int __reloc_check(const uint32_t *src, size_t n, uintptr_t pc);
+
+/*  whole funct @ pc:  no direct branch into [lo, hi),  no br  (its
+ *  targ can't be known).   SILKHOOK_ERR_INSTR otherwise  */
+int __reloc_scan(const uint32_t *src, size_t n, uintptr_t pc, uintptr_t lo, uintptr_t hi);
 int __reloc(uint32_t instr, uintptr_t pc, struct __codebuf *cb);
 
+/*  same,  w/o touching x16 / x17.   SILKHOOK_ERR_INSTR if it can't  */
+int __reloc_probe(uint32_t instr, uintptr_t pc, struct __codebuf *cb);
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * foreign stubs
+ *
+ * a prologue that's already someone's jmp stub isn't relocated,  it's
+ * followed.   recognised  (x16 / x17,  optional leading bti):
+ *
+ *   ldr  x16, lit ; br x16 [; .quad]           our __ABS_JMP,  frida,  ...
+ *   adrp x16, pg ; add x16, x16, lo12 ; br x16
+ *   b    dest
+ *
+ * the literal must lie inside the stub's own bytes and only the first
+ * hop is taken - dest isn't chased any further.   len is all the hook
+ * may overwrite
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+struct __reloc_stub {
+    uintptr_t   dest;
+    size_t      len;
+};
+
+/*  1 if src  (orig bytes @ pc)  is a jmp stub no longer than max bytes  */
+int __reloc_follow(const uint32_t *src, uintptr_t pc, size_t max, struct __reloc_stub *out);
+
 
 #endif /* _SILKHOOK_RELOCATOR_H_ */
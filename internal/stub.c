@@ -0,0 +1,660 @@
+/*
+ * silkhook - miniature arm64 hooking lib
+ * stub.c   - generated ctx stubs
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "stub.h"
+#include "relocator.h"
+#include "../include/types.h"
+#include "../include/status.h"
+
+#ifdef __KERNEL__
+    #include <linux/string.h>
+#else
+    #include <string.h>
+#endif
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * ctx spill / reload
+ *
+ * x16 / x17 (IP0 / IP1) are scratch once they're saved
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static void __stub_emit_save(struct __codebuf *cb, const struct __ctx_stub *s)
+{
+    unsigned r;
+    size_t off;
+
+    __CODEBUF_EMIT(cb, __SUB_IMM(__REG_SP, __REG_SP, s->frame));
+
+    for (r = 0; r < 30; r += 2)
+        __CODEBUF_EMIT(cb, __STP(r, r + 1, __REG_SP, r * 8));
+
+    /*  regs[30],  sp as it was on entry  */
+    __CODEBUF_EMIT(cb, __ADD_IMM(16, __REG_SP, s->frame));
+    __CODEBUF_EMIT(cb, __STP(30, 16, __REG_SP, 240));
+
+    __EMIT_MOV64_OPT(cb, 16, s->pc);
+    __CODEBUF_EMIT(cb, __STR_X(16, __REG_SP, __STUB_REGS_PC));
+
+    __CODEBUF_EMIT(cb, __MRS_NZCV(17));
+    if (s->pstate)
+    {
+        __EMIT_MOV64_OPT(cb, 16, s->pstate);
+        __CODEBUF_EMIT(cb, __ORR(17, 17, 16));
+    }
+    __CODEBUF_EMIT(cb, __STR_X(17, __REG_SP, __STUB_REGS_PSTATE));
+
+    for (off = __STUB_REGS_MIN; off + 16 <= s->frame; off += 16)
+        __CODEBUF_EMIT(cb, __STP(__REG_XZR, __REG_XZR, __REG_SP, off));
+}
+
+static void __stub_emit_restore(struct __codebuf *cb, const struct __ctx_stub *s)
+{
+    unsigned r;
+
+    __CODEBUF_EMIT(cb, __LDR_X(16, __REG_SP, __STUB_REGS_PSTATE));
+    __CODEBUF_EMIT(cb, __MSR_NZCV(16));
+
+    for (r = 0; r < 30; r += 2)
+        __CODEBUF_EMIT(cb, __LDP(r, r + 1, __REG_SP, r * 8));
+    __CODEBUF_EMIT(cb, __LDR_X(30, __REG_SP, 240));
+
+    __CODEBUF_EMIT(cb, __ADD_IMM(__REG_SP, __REG_SP, s->frame));
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * fp / simd spill / reload
+ *
+ * runs after the GP save,  so x16 / x17 r scratch again.   leaves
+ * x0 = regs for the call:
+ *
+ *   NEON:  [sp]  q0 - q31  | fpsr |  pt_regs
+ *   SVE:   [sp]  p0 - p15, ffr  (3 VL)  |  z0 - z31  (32 VL)  | fpsr |  pt_regs
+ *
+ * the whole file goes - mid function any of it can be live,  not just
+ * what the pcs calls caller saved
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define __STUB_NEON_AREA    (32u * 16u)
+#define __STUB_SVE_PRED_VL  3       /*  17 pred slots of VL / 8,  16-byte aligned  */
+
+static void __stub_emit_fp_save(struct __codebuf *cb, const struct __ctx_stub *s)
+{
+    unsigned r;
+
+    if (s->fp == __STUB_FP_NONE)
+    {
+        __CODEBUF_EMIT(cb, __ADD_IMM(0, __REG_SP, 0));
+        return;
+    }
+
+    __CODEBUF_EMIT(cb, __SUB_IMM(__REG_SP, __REG_SP, 16));
+    __CODEBUF_EMIT(cb, __MRS_FPSR(16));
+    __CODEBUF_EMIT(cb, __STR_X(16, __REG_SP, 0));
+
+    if (s->fp == __STUB_FP_NEON)
+    {
+        __CODEBUF_EMIT(cb, __SUB_IMM(__REG_SP, __REG_SP, __STUB_NEON_AREA));
+        for (r = 0; r < 32; r += 2)
+            __CODEBUF_EMIT(cb, __STP_Q(r, r + 1, __REG_SP, r * 16));
+
+        __CODEBUF_EMIT(cb, __ADD_IMM(0, __REG_SP, __STUB_NEON_AREA + 16));
+        return;
+    }
+
+    __CODEBUF_EMIT(cb, __ADDVL(__REG_SP, __REG_SP, -32));
+    __CODEBUF_EMIT(cb, __ADDVL(__REG_SP, __REG_SP, -__STUB_SVE_PRED_VL));
+
+    /*  preds before rdffr clobbers p0  */
+    for (r = 0; r < 16; r++)
+        __CODEBUF_EMIT(cb, __STR_P(r, __REG_SP, r));
+    __CODEBUF_EMIT(cb, __RDFFR(0));
+    __CODEBUF_EMIT(cb, __STR_P(0, __REG_SP, 16));
+
+    __CODEBUF_EMIT(cb, __ADDVL(17, __REG_SP, __STUB_SVE_PRED_VL));
+    for (r = 0; r < 32; r++)
+        __CODEBUF_EMIT(cb, __STR_Z(r, 17, r));
+
+    __CODEBUF_EMIT(cb, __ADDVL(0, __REG_SP, 31));
+    __CODEBUF_EMIT(cb, __ADDVL(0, 0, 1 + __STUB_SVE_PRED_VL));
+    __CODEBUF_EMIT(cb, __ADD_IMM(0, 0, 16));
+}
+
+static void __stub_emit_fp_restore(struct __codebuf *cb, const struct __ctx_stub *s)
+{
+    unsigned r;
+
+    if (s->fp == __STUB_FP_NONE)
+        return;
+
+    if (s->fp == __STUB_FP_NEON)
+    {
+        for (r = 0; r < 32; r += 2)
+            __CODEBUF_EMIT(cb, __LDP_Q(r, r + 1, __REG_SP, r * 16));
+        __CODEBUF_EMIT(cb, __ADD_IMM(__REG_SP, __REG_SP, __STUB_NEON_AREA));
+    }
+    else
+    {
+        __CODEBUF_EMIT(cb, __ADDVL(17, __REG_SP, __STUB_SVE_PRED_VL));
+        for (r = 0; r < 32; r++)
+            __CODEBUF_EMIT(cb, __LDR_Z(r, 17, r));
+
+        __CODEBUF_EMIT(cb, __LDR_P(0, __REG_SP, 16));
+        __CODEBUF_EMIT(cb, __WRFFR(0));
+        for (r = 0; r < 16; r++)
+            __CODEBUF_EMIT(cb, __LDR_P(r, __REG_SP, r));
+
+        __CODEBUF_EMIT(cb, __ADDVL(__REG_SP, __REG_SP, 31));
+        __CODEBUF_EMIT(cb, __ADDVL(__REG_SP, __REG_SP, 1 + __STUB_SVE_PRED_VL));
+    }
+
+    __CODEBUF_EMIT(cb, __LDR_X(16, __REG_SP, 0));
+    __CODEBUF_EMIT(cb, __MSR_FPSR(16));
+    __CODEBUF_EMIT(cb, __ADD_IMM(__REG_SP, __REG_SP, 16));
+}
+
+
+/*  reg = *(u64 *) addr,  lo12 folded into the ldr  (addr 8-byte aligned)  */
+static void __stub_emit_load(struct __codebuf *cb, unsigned reg, uintptr_t addr)
+{
+    uintptr_t pc = __CODEBUF_PC(cb);
+    int64_t  pg  = (int64_t) ((addr & ~(uintptr_t) 0xFFF) - (pc & ~(uintptr_t) 0xFFF));
+
+    if (__IN_RANGE(pg, __ADRP_RANGE))
+    {
+        __CODEBUF_EMIT(cb, __ADRP(reg, pg));
+        __CODEBUF_EMIT(cb, __LDR_X(reg, reg, addr & 0xFFF));
+        return;
+    }
+
+    __EMIT_MOV64_OPT(cb, reg, addr);
+    __CODEBUF_EMIT(cb, __LDR_X(reg, reg, 0));
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * public
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+void __stub_emit_ctx_call(struct __codebuf *cb, const struct __ctx_stub *s)
+{
+    __stub_emit_save(cb, s);
+    __stub_emit_fp_save(cb, s);
+
+    /*  fn(regs, arg),  x0 set above  */
+    __EMIT_MOV64_OPT(cb, 1, s->arg);
+    __EMIT_MOV64_OPT(cb, 16, s->fn);
+    __CODEBUF_EMIT(cb, __BLR(16));
+
+    __stub_emit_fp_restore(cb, s);
+    __stub_emit_restore(cb, s);
+}
+
+/*  pass conds per SILKHOOK_PRED_*,  a miss branches on the inverse  (^ 1)  */
+static const uint32_t __pred_cond[] = {
+    [SILKHOOK_PRED_EQ]   = __COND_EQ,
+    [SILKHOOK_PRED_NE]   = __COND_NE,
+    [SILKHOOK_PRED_LO]   = __COND_LO,
+    [SILKHOOK_PRED_LS]   = __COND_LS,
+    [SILKHOOK_PRED_HI]   = __COND_HI,
+    [SILKHOOK_PRED_HS]   = __COND_HS,
+    [SILKHOOK_PRED_LT]   = __COND_LT,
+    [SILKHOOK_PRED_LE]   = __COND_LE,
+    [SILKHOOK_PRED_GT]   = __COND_GT,
+    [SILKHOOK_PRED_GE]   = __COND_GE,
+    [SILKHOOK_PRED_ANY]  = __COND_NE,
+    [SILKHOOK_PRED_NONE] = __COND_EQ,
+    [SILKHOOK_PRED_IN]   = __COND_NE,
+};
+
+/*  b.cond w/ its target still open  */
+struct __stub_fix {
+    size_t      at;
+    uint32_t    cond;
+};
+
+#define __STUB_FIX_MAX      (2 * SILKHOOK_MAX_PRED)
+
+static int __stub_pred_check(const struct silkhook_pred *p)
+{
+    if (p->op > SILKHOOK_PRED_IN || p->arg > 7 ||
+        (p->flags & ~(SILKHOOK_PRED_REG | SILKHOOK_PRED_W | SILKHOOK_PRED_OR)))
+        return SILKHOOK_ERR_INVAL;
+
+    if ((p->flags & SILKHOOK_PRED_REG) && (p->reg > 7 || p->op == SILKHOOK_PRED_IN))
+        return SILKHOOK_ERR_INVAL;
+
+    if (p->op == SILKHOOK_PRED_IN && (!p->map || !p->imm))
+        return SILKHOOK_ERR_INVAL;
+
+    return SILKHOOK_OK;
+}
+
+/*  cmp x<rn>, #imm,  through x16 when it won't fit an imm12  */
+static void __stub_emit_cmp(struct __codebuf *cb, unsigned rn, uint64_t imm, int w)
+{
+    if (imm <= 0xFFF)
+        __CODEBUF_EMIT(cb, w ? __CMP_W_IMM(rn, imm, 0) : __CMP_IMM(rn, imm, 0));
+    else if (!(imm & 0xFFF) && imm <= 0xFFF000)
+        __CODEBUF_EMIT(cb, w ? __CMP_W_IMM(rn, imm >> 12, 1) : __CMP_IMM(rn, imm >> 12, 1));
+    else
+    {
+        __EMIT_MOV64_OPT(cb, 16, imm);
+        __CODEBUF_EMIT(cb, w ? __CMP_W_REG(rn, 16) : __CMP_REG(rn, 16));
+    }
+}
+
+static void __stub_emit_miss(struct __codebuf *cb, uint32_t cond,
+                             struct __stub_fix *fix, size_t *n_fix)
+{
+    fix[*n_fix].at   = cb->len;
+    fix[*n_fix].cond = cond ^ 1u;
+    (*n_fix)++;
+    __CODEBUF_EMIT(cb, __B_COND(cond ^ 1u, 0));
+}
+
+/*  one term,  falls through if it holds  */
+static void __stub_emit_term(struct __codebuf *cb, const struct silkhook_pred *p,
+                             struct __stub_fix *fix, size_t *n_fix)
+{
+    int w = !!(p->flags & SILKHOOK_PRED_W);
+    uint64_t imm = w ? (uint32_t) p->imm : p->imm;
+    unsigned rm = p->reg;
+
+    switch (p->op)
+    {
+    case SILKHOOK_PRED_IN:
+        /*  x < nbits,  then bit x of map[x >> 6]  */
+        __stub_emit_cmp(cb, p->arg, imm, w);
+        __stub_emit_miss(cb, __COND_LO, fix, n_fix);
+        __EMIT_PCREL_ADDR(cb, 17, (uintptr_t) p->map);
+        __CODEBUF_EMIT(cb, w ? __LSR_W_IMM(16, p->arg, 6) : __LSR_IMM(16, p->arg, 6));
+        __CODEBUF_EMIT(cb, __LDR_X_REG(16, 17, 16));
+        __CODEBUF_EMIT(cb, __LSRV(16, 16, p->arg));
+        __CODEBUF_EMIT(cb, __TST_1(16));
+        break;
+
+    case SILKHOOK_PRED_ANY:
+    case SILKHOOK_PRED_NONE:
+        if (!(p->flags & SILKHOOK_PRED_REG))
+        {
+            __EMIT_MOV64_OPT(cb, 16, imm);
+            rm = 16;
+        }
+        __CODEBUF_EMIT(cb, w ? __TST_W_REG(p->arg, rm) : __TST_REG(p->arg, rm));
+        break;
+
+    default:
+        if (p->flags & SILKHOOK_PRED_REG)
+            __CODEBUF_EMIT(cb, w ? __CMP_W_REG(p->arg, rm) : __CMP_REG(p->arg, rm));
+        else
+            __stub_emit_cmp(cb, p->arg, imm, w);
+        break;
+    }
+
+    __stub_emit_miss(cb, __pred_cond[p->op], fix, n_fix);
+}
+
+/*  clauses of AND'd terms,  OR'd.   a miss tries the next clause,  misses
+ *  in the last one r left in out[] for the caller to aim at orig.   a
+ *  matching clause ends up right after the last  */
+static void __stub_emit_preds(struct __codebuf *cb, const struct silkhook_pred *pred, size_t n,
+                              struct __stub_fix *out, size_t *n_out)
+{
+    struct __stub_fix miss[__STUB_FIX_MAX];
+    size_t hit[SILKHOOK_MAX_PRED];
+    size_t n_miss, n_hit = 0, i = 0, k;
+
+    while (i < n)
+    {
+        n_miss = 0;
+
+        do
+            __stub_emit_term(cb, &pred[i++], miss, &n_miss);
+        while (i < n && !(pred[i].flags & SILKHOOK_PRED_OR));
+
+        if (i == n)
+        {
+            memcpy(out, miss, n_miss * sizeof(*miss));
+            *n_out = n_miss;
+            break;
+        }
+
+        hit[n_hit++] = cb->len;
+        __CODEBUF_EMIT(cb, __B(0));             /*  fixed up below  */
+
+        for (k = 0; k < n_miss; k++)
+            __CODEBUF_AT(cb, miss[k].at, __B_COND(miss[k].cond, (cb->len - miss[k].at) * 4));
+    }
+
+    for (k = 0; k < n_hit; k++)
+        __CODEBUF_AT(cb, hit[k], __B((cb->len - hit[k]) * 4));
+}
+
+/*  uniform in [period - 2^(k-1),  period + 2^(k-1)),  2^k <= period.
+ *  low counter bits r noise enough to keep samples from locking onto
+ *  a call pattern  */
+static void __stub_emit_reload(struct __codebuf *cb, uint32_t period)
+{
+    unsigned k = 0;
+    uint32_t base;
+
+    while (k < 31 && (2u << k) <= period)
+        k++;
+    base = period - ((1u << k) >> 1);
+
+    __CODEBUF_EMIT(cb, __MRS_CNTVCT(16));
+    __CODEBUF_EMIT(cb, __UBFX_W(16, 16, 0, k ? k : 1));
+    if (base & 0xFFF)
+        __CODEBUF_EMIT(cb, __ADD_W_IMM(16, 16, base & 0xFFF, 0));
+    if (base >> 12)
+        __CODEBUF_EMIT(cb, __ADD_W_IMM(16, 16, base >> 12, 1));
+}
+
+/*  x17 = *(u64 *) (base + off)  */
+static void __stub_emit_tp_load(struct __codebuf *cb, uint32_t mrs, uintptr_t off)
+{
+    __CODEBUF_EMIT(cb, mrs);
+
+    if ((off & 7) || off > 0x7FF8)
+    {
+        __EMIT_MOV64_OPT(cb, 16, off);
+        __CODEBUF_EMIT(cb, __ADD_REG(17, 17, 16));
+        off = 0;
+    }
+
+    __CODEBUF_EMIT(cb, __LDR_X(17, 17, off));
+}
+
+/*  x17 = current's id,  then one cmp per id.   falls through on a match,
+ *  the miss after the last one is left in fix[] for orig  */
+static void __stub_emit_task(struct __codebuf *cb, const struct __entry_stub *e,
+                             struct __stub_fix *fix, size_t *n_fix)
+{
+    size_t hit[SILKHOOK_MAX_IDS];
+    size_t i;
+    int w;
+
+    __CODEBUF_EMIT(cb, __MRS_SP_EL0(17));
+
+    for (i = 0; i < e->n_hops; i++)
+    {
+        uintptr_t off = e->hop[i];
+
+        w = e->id_w && i == e->n_hops - 1;
+        if ((off & (w ? 3 : 7)) || off > (w ? 0x3FFCu : 0x7FF8u))
+        {
+            __EMIT_MOV64_OPT(cb, 16, off);
+            __CODEBUF_EMIT(cb, __ADD_REG(17, 17, 16));
+            off = 0;
+        }
+        __CODEBUF_EMIT(cb, w ? __LDR_W(17, 17, off) : __LDR_X(17, 17, off));
+    }
+
+    for (i = 0; i < e->n_ids; i++)
+    {
+        __stub_emit_cmp(cb, 17, e->id_w ? (uint32_t) e->ids[i] : e->ids[i], e->id_w);
+        if (i == e->n_ids - 1)
+            __stub_emit_miss(cb, __COND_EQ, fix, n_fix);
+        else
+        {
+            hit[i] = cb->len;
+            __CODEBUF_EMIT(cb, __B_COND(__COND_EQ, 0));     /*  fixed up below  */
+        }
+    }
+
+    for (i = 0; i + 1 < e->n_ids; i++)
+        __CODEBUF_AT(cb, hit[i], __B_COND(__COND_EQ, (cb->len - hit[i]) * 4));
+}
+
+/*  x17 = base + off  */
+static void __stub_emit_tp_addr(struct __codebuf *cb, uint32_t mrs, uintptr_t off)
+{
+    __CODEBUF_EMIT(cb, mrs);
+
+    if (off <= 0xFFF)
+        __CODEBUF_EMIT(cb, __ADD_IMM(17, 17, off));
+    else
+    {
+        __EMIT_MOV64_OPT(cb, 16, off);
+        __CODEBUF_EMIT(cb, __ADD_REG(17, 17, 16));
+    }
+}
+
+#define __EPOCH_DEPTH_OFF   offsetof(struct __epoch_rec, depth)
+#define __EPOCH_QSEQ_OFF    offsetof(struct __epoch_rec, qseq)
+#define __EPOCH_LIST_OFF    offsetof(struct __epoch_rec, on_list)
+
+/*  mov x17, x30 ; bl enter ; cbz x16, 4f ; bl 5f ; jmp exit ; 4: mov x30, x17
+ *  - the rest of the stub  (5:)  starts right after.   a thread is only
+ *  in here w/ its qseq held:  before depth + 1 it can't have moved,  and
+ *  it's bumped in the thunk,  after the jmp out  */
+static void __stub_emit_epoch(struct __codebuf *cb, const struct __entry_stub *e)
+{
+    uintptr_t pc;
+    size_t at, skip, call;
+
+    __CODEBUF_EMIT(cb, __ORR(17, __REG_XZR, 30));
+
+    pc = __CODEBUF_PC(cb);
+    if (__B_REACH(pc, e->epoch))
+        __CODEBUF_EMIT(cb, __BL(e->epoch - pc));
+    else
+    {
+        /*  adr x30, <past the jmp>  */
+        at = cb->len;
+        __CODEBUF_EMIT(cb, 0);
+        __EMIT_JMP(cb, e->epoch);
+        __CODEBUF_AT(cb, at, __ADR(30, (cb->len - at) * 4));
+    }
+
+    skip = cb->len;
+    __CODEBUF_EMIT(cb, __CBZ_X(16, 0));             /*  fixed up below  */
+    call = cb->len;
+    __CODEBUF_EMIT(cb, __BL(0));                    /*  fixed up below  */
+    __EMIT_JMP(cb, e->epoch_exit);
+
+    /*  shadow stack full,  untracked - the caller's lr came back in x17  */
+    __CODEBUF_AT(cb, skip, __CBZ_X(16, (cb->len - skip) * 4));
+    __CODEBUF_EMIT(cb, __ORR(30, __REG_XZR, 17));
+    __CODEBUF_AT(cb, call, __BL((cb->len - call) * 4));
+}
+
+/*  countdown,  falls through on a hit.   x17 = count's base on entry  */
+static void __stub_emit_sample(struct __codebuf *cb, const struct __entry_stub *e)
+{
+    uintptr_t off = e->count;
+    size_t hit;
+
+    __CODEBUF_EMIT(cb, e->tp_mrs);
+
+    if ((off & 3) || off > 0x3FFC)
+    {
+        __EMIT_MOV64_OPT(cb, 16, off);
+        __CODEBUF_EMIT(cb, __ADD_REG(17, 17, 16));
+        off = 0;
+    }
+
+    __CODEBUF_EMIT(cb, __LDR_W(16, 17, off));
+    __CODEBUF_EMIT(cb, __SUBS_W_IMM(16, 16, 1));
+    hit = cb->len;
+    __CODEBUF_EMIT(cb, __B_COND(__COND_LS, 0));    /*  fixed up below  */
+    __CODEBUF_EMIT(cb, __STR_W(16, 17, off));
+    __EMIT_JMP(cb, e->orig);
+
+    __CODEBUF_AT(cb, hit, __B_COND(__COND_LS, (cb->len - hit) * 4));
+    __stub_emit_reload(cb, e->period);
+    __CODEBUF_EMIT(cb, __STR_W(16, 17, off));
+}
+
+int __stub_emit_entry(struct __codebuf *cb, void *ctx)
+{
+    const struct __entry_stub *e = ctx;
+    struct __stub_fix miss[__STUB_FIX_MAX + 1];
+    size_t skip = 0, tskip = 0, n_miss = 0, n_pmiss = 0, i;
+
+    if ((e->gate & 7) || (e->slot & 7) || e->bit > 63)
+        return SILKHOOK_ERR_INVAL;
+    if (e->period && (e->period < 2 || e->period > __STUB_PERIOD_MAX))
+        return SILKHOOK_ERR_INVAL;
+    if (e->n_pred > SILKHOOK_MAX_PRED || (e->n_pred && !e->pred))
+        return SILKHOOK_ERR_INVAL;
+
+    for (i = 0; i < e->n_pred; i++)
+        if (__stub_pred_check(&e->pred[i]) != SILKHOOK_OK)
+            return SILKHOOK_ERR_INVAL;
+
+    if (e->n_ids > SILKHOOK_MAX_IDS || e->n_hops > __STUB_MAX_HOPS ||
+        (e->n_ids && (!e->ids || !e->n_hops)))
+        return SILKHOOK_ERR_INVAL;
+
+    __CODEBUF_EMIT(cb, __BTI_C());
+
+    if (e->epoch)
+        __stub_emit_epoch(cb, e);
+
+    if (e->gate)
+    {
+        __stub_emit_load(cb, 17, e->gate);
+        skip = cb->len;
+        __CODEBUF_EMIT(cb, __TBZ(17, e->bit, 0));   /*  fixed up below  */
+    }
+
+    if (e->thread)
+    {
+        __stub_emit_tp_load(cb, e->tp_mrs, e->mask);
+        tskip = cb->len;
+        __CODEBUF_EMIT(cb, __TBZ(17, e->bit, 0));   /*  fixed up below  */
+    }
+
+    if (e->n_ids)
+        __stub_emit_task(cb, e, miss, &n_miss);
+
+    if (e->n_pred)
+        __stub_emit_preds(cb, e->pred, e->n_pred, miss + n_miss, &n_pmiss);
+    n_miss += n_pmiss;
+
+    if (e->period)
+        __stub_emit_sample(cb, e);
+
+    if (e->ret)
+    {
+        if (e->slot)
+            __stub_emit_load(cb, 0, e->slot);
+        else
+            __EMIT_MOV64_OPT(cb, 0, e->value);
+        __CODEBUF_EMIT(cb, __RET());
+    }
+    else if (e->slot)
+    {
+        __stub_emit_load(cb, 16, e->slot);
+        __CODEBUF_EMIT(cb, __BR(16));
+    }
+    else
+        __EMIT_JMP(cb, e->detour);
+
+    if (e->gate)
+        __CODEBUF_AT(cb, skip, __TBZ(17, e->bit, (cb->len - skip) * 4));
+    if (e->thread)
+        __CODEBUF_AT(cb, tskip, __TBZ(17, e->bit, (cb->len - tskip) * 4));
+
+    for (i = 0; i < n_miss; i++)
+        __CODEBUF_AT(cb, miss[i].at, __B_COND(miss[i].cond, (cb->len - miss[i].at) * 4));
+
+    if (e->gate || e->thread || e->n_ids || e->n_pred)
+        __EMIT_JMP(cb, e->orig);
+
+    return SILKHOOK_OK;
+}
+
+int __stub_emit_epoch_thunk(struct __codebuf *cb, void *ctx)
+{
+    struct __epoch_thunk *t = ctx;
+    struct __ctx_stub reg = t->reg;
+    size_t full, join, done;
+
+    reg.pc = __CODEBUF_PC(cb);
+
+    /*  enter:  x17 = caller's lr,  x30 = back into the stub  */
+    __CODEBUF_EMIT(cb, __PUSH(30));
+    __CODEBUF_EMIT(cb, __ORR(30, __REG_XZR, 17));
+    __stub_emit_tp_addr(cb, t->tp_mrs, t->rec);
+    __CODEBUF_EMIT(cb, __LDR_X(16, 17, __EPOCH_DEPTH_OFF));
+    __CODEBUF_EMIT(cb, __CMP_IMM(16, __EPOCH_DEPTH, 0));
+    full = cb->len;
+    __CODEBUF_EMIT(cb, __B_COND(__COND_HS, 0));     /*  fixed up below  */
+    __CODEBUF_EMIT(cb, __STR_X_REG(30, 17, 16));
+    __CODEBUF_EMIT(cb, __ADD_IMM(16, 16, 1));
+    __CODEBUF_EMIT(cb, __STR_X(16, 17, __EPOCH_DEPTH_OFF));
+
+    /*  first tracked call on this thread,  put its rec on the list.   the
+     *  ctx call reloads everything as it was  */
+    __CODEBUF_EMIT(cb, __LDR_X(16, 17, __EPOCH_LIST_OFF));
+    join = cb->len;
+    __CODEBUF_EMIT(cb, __CBNZ_X(16, 0));
+    __stub_emit_ctx_call(cb, &reg);
+    __CODEBUF_AT(cb, join, __CBNZ_X(16, (cb->len - join) * 4));
+
+    __CODEBUF_EMIT(cb, __MOVZ(16, 1, 0));
+    __CODEBUF_EMIT(cb, __POP(30));
+    __CODEBUF_EMIT(cb, __RET());
+
+    /*  full:  x16 = 0,  lr back in x17  */
+    __CODEBUF_AT(cb, full, __B_COND(__COND_HS, (cb->len - full) * 4));
+    __CODEBUF_EMIT(cb, __ORR(17, __REG_XZR, 30));
+    __CODEBUF_EMIT(cb, __MOVZ(16, 0, 0));
+    __CODEBUF_EMIT(cb, __POP(30));
+    __CODEBUF_EMIT(cb, __RET());
+
+    /*  exit:  x0 / x1 / v0 .. hold the result,  only x16 / x17 / x30 r
+     *  touched.   the ret is the caller's,  no stub code left to run  */
+    t->exit = __CODEBUF_SIZE(cb);
+    __stub_emit_tp_addr(cb, t->tp_mrs, t->rec);
+    __CODEBUF_EMIT(cb, __LDR_X(16, 17, __EPOCH_DEPTH_OFF));
+    __CODEBUF_EMIT(cb, __SUB_IMM(16, 16, 1));
+    __CODEBUF_EMIT(cb, __STR_X(16, 17, __EPOCH_DEPTH_OFF));
+    __CODEBUF_EMIT(cb, __LDR_X_REG(30, 17, 16));
+    done = cb->len;
+    __CODEBUF_EMIT(cb, __CBNZ_X(16, 0));
+    __CODEBUF_EMIT(cb, __LDR_X(16, 17, __EPOCH_QSEQ_OFF));
+    __CODEBUF_EMIT(cb, __ADD_IMM(16, 16, 1));
+    __CODEBUF_EMIT(cb, __STR_X(16, 17, __EPOCH_QSEQ_OFF));
+    __CODEBUF_AT(cb, done, __CBNZ_X(16, (cb->len - done) * 4));
+    __CODEBUF_EMIT(cb, __RET());
+
+    return SILKHOOK_OK;
+}
+
+int __stub_emit_probe(struct __codebuf *cb, void *ctx)
+{
+    const struct __probe_stub *p = ctx;
+    struct __ctx_stub s = {
+        .frame  = SILKHOOK_PT_REGS_SIZE,
+        .pc     = p->pc,
+        .fn     = p->fn,
+        .arg    = p->arg,
+        .fp     = p->fp,
+    };
+    uintptr_t pc;
+    int status;
+
+    cb->bti = p->bti;
+
+    __stub_emit_ctx_call(cb, &s);
+
+    status = __reloc_probe(p->instr, p->pc, cb);
+    if (status != SILKHOOK_OK)
+        return status;
+
+    /*  back w/ a plain b,  x16 may be live there  */
+    pc = __CODEBUF_PC(cb);
+    if (!__B_REACH(pc, p->pc + SILKHOOK_INSTR_SIZE))
+        return SILKHOOK_ERR_NOMEM;
+    __CODEBUF_EMIT(cb, __B(p->pc + SILKHOOK_INSTR_SIZE - pc));
+    return SILKHOOK_OK;
+}
@@ -0,0 +1,242 @@
+/*
+ * silkhook - miniature arm64 hooking lib
+ * stub.h   - generated ctx stubs
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _SILKHOOK_STUB_H_
+#define _SILKHOOK_STUB_H_
+
+#ifdef __KERNEL__
+    #include <linux/types.h>
+#else
+    #include <stdint.h>
+    #include <stddef.h>
+#endif
+
+#include "arch.h"
+#include "assembler.h"
+
+struct silkhook_pred;
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * ctx stub
+ *
+ * spills the GP ctx into a pt_regs shaped frame on the stack,
+ * calls fn(regs, arg),  reloads the ctx and falls through to
+ * whatever gets emitted next  (reloc'd instrs,  jump back, ...)
+ *
+ *   ┌──────────────────────────────┐
+ *   │ sub  sp, sp, #frame          │
+ *   │ stp  x0 .. x29  -> [sp]      │
+ *   │ stp  x30, sp_orig            │  <- regs[30], sp
+ *   │ str  pc,  nzcv | pstate      │  <- pc, pstate
+ *   │ stp  xzr, xzr  ...           │  <- zero the rest of the frame
+ *   │ mov  x0, sp                  │
+ *   │ mov  x1, #arg                │
+ *   │ mov  x16, #fn                │
+ *   │ blr  x16                     │
+ *   │ msr  nzcv, <saved>           │
+ *   │ ldp  x0 .. x30  <- [sp]      │
+ *   │ add  sp, sp, #frame          │
+ *   └──────────────────────────────┘
+ *
+ * frame layout matches kernel struct pt_regs for the first 272 bytes:
+ *   x0-x30 @ 0,   sp @ 248,   pc @ 256,   pstate @ 264
+ *
+ * fn may rewrite any saved reg,  it's reloaded on the way out.
+ * sp / pc writes are ignored
+ *
+ * fp / simd regs r spilled below the frame unless fn can't touch them:
+ *
+ *   NONE:  fn is general-regs-only  (SILKHOOK_OPT_NOFP,  kernel)
+ *   NEON:  q0 - q31 + fpsr                          528 bytes
+ *   SVE:   z0 - z31,  p0 - p15,  ffr + fpsr         35 VL + 16,  sized
+ *          from the live VL  (addvl),  not the arch max
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define __STUB_REGS_SP          248u
+#define __STUB_REGS_PC          256u
+#define __STUB_REGS_PSTATE      264u
+#define __STUB_REGS_MIN         272u
+#define __STUB_FRAME_MAX        512u
+
+#define __STUB_MAX              512u
+
+#define __STUB_FP_NONE          0
+#define __STUB_FP_NEON          1
+#define __STUB_FP_SVE           2
+
+struct __ctx_stub {
+    size_t      frame;      /*  16-byte aligned,  MIN..FRAME_MAX  */
+    uintptr_t   pc;         /*  reported as regs->pc              */
+    uint64_t    pstate;     /*  or'd into the saved nzcv          */
+    uintptr_t   fn;         /*  void fn(regs, arg)                */
+    uintptr_t   arg;
+    int         fp;         /*  __STUB_FP_*                       */
+};
+
+void __stub_emit_ctx_call(struct __codebuf *cb, const struct __ctx_stub *s);
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * entry stub
+ *
+ * sits between a patched targ and its detour.   each enabled check can
+ * send the call straight to orig:
+ *
+ *   ┌──────────────────────────────┐
+ *   │ bti  c                       │
+ *   │ adrp x17, gate               │  <- gated:  bit in a data word
+ *   │ ldr  x17, [x17, lo12]        │
+ *   │ tbz  x17, #bit, 9f           │
+ *   ├──────────────────────────────┤
+ *   │ mrs  x17, tpidr_el0          │  <- thread:  this thread's mask
+ *   │ ldr  x17, [x17, #mask]       │
+ *   │ tbz  x17, #bit, 9f           │
+ *   ├──────────────────────────────┤
+ *   │ mrs  x17, sp_el0             │  <- task  (kernel):  current's
+ *   │ ldr  w17, [x17, #tgid]       │     tgid
+ *   │ cmp  x17, #id0 ; b.eq 4f     │
+ *   │ cmp  x17, #idN ; b.ne 9f     │
+ *   ├──────────────────────────────┤
+ *   │ 4: cmp x0, #imm              │  <- predicates:  per term,  a miss
+ *   │ b.ne 2f                      │     skips to the next clause,  or
+ *   │ ...                          │     9f after the last one
+ *   │ b    3f                      │
+ *   │ 2: ...                       │
+ *   ├──────────────────────────────┤
+ *   │ 3: mrs x17, tpidr_elN        │  <- sampled:  per-thread / per-cpu
+ *   │ ldr  w16, [x17, #count]      │     countdown
+ *   │ subs w16, w16, #1            │
+ *   │ b.ls 1f                      │
+ *   │ str  w16, [x17, #count]      │
+ *   │ <jmp orig>                   │
+ *   │ 1: mrs x16, cntvct_el0       │  <- hit,  reload w/ jitter
+ *   │ ubfx / add  w16 ...          │
+ *   │ str  w16, [x17, #count]      │
+ *   ├──────────────────────────────┤
+ *   │ <jmp detour>                 │  <- or,  w/ a slot:
+ *   │ 9: <jmp orig>                │       adrp x16, slot
+ *   └──────────────────────────────┘       ldr  x16, [x16, lo12]
+ *                                          br   x16
+ *
+ * ret stubs end in  mov x0, #value ; ret  instead of the detour jmp,
+ * the caller gets value back w/o entering C  (x0 loaded from the slot
+ * if there is one)
+ *
+ * epoch stubs wrap all of the above in a per-thread depth count,  so
+ * the reclaimer can tell when no thread is left inside.   the count
+ * itself lives in one thunk per process that's never freed - the qseq
+ * bump and the ret after it can't run from code that's being retired:
+ *
+ *   ┌──────────────────────────────┐      thunk  (shared)
+ *   │ bti  c                       │      ┌──────────────────────────────┐
+ *   │ mov  x17, x30                │      │ enter:                       │
+ *   │ bl   enter                   │ ───▶ │ push x30 ;  x17 = &rec       │
+ *   │ cbz  x16, 4f                 │      │ lr[depth++] = caller's lr    │
+ *   │ bl   5f                      │      │ <ctx call>  register(rec)    │
+ *   │ jmp  exit                    │ ──┐  │ x16 = 1 ;  pop x30 ;  ret    │
+ *   │ 4: mov x30, x17              │   │  ├──────────────────────────────┤
+ *   │ 5: <checks,  detour / orig>  │   └▶ │ exit:                        │
+ *   └──────────────────────────────┘      │ x30 = lr[--depth]            │
+ *                                         │ depth 0:  qseq + 1           │
+ *                                         │ ret                          │
+ *                                         └──────────────────────────────┘
+ *
+ * register runs once per thread.   x16 comes back 0 when lr[] is full,
+ * the call then isn't tracked
+ *
+ * x16 / x17 r free on function entry  (IP0 / IP1),  so r the flags -
+ * nothing is spilled bar the epoch thunk's own ret addr.   the word,
+ * the counts and the slot r plain data,  changing them never touches
+ * text
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define __STUB_MAX_HOPS     4
+#define __EPOCH_DEPTH       32
+
+/*  one per thread,  in tls.   the thunk only touches lr .. on_list  */
+struct __epoch_rec {
+    uint64_t    lr[__EPOCH_DEPTH];  /*  callers' lrs,  innermost @ depth - 1  */
+    uint64_t    depth;
+    uint64_t    qseq;       /*  +1 each time depth drops back to 0  */
+    uint64_t    on_list;
+    struct __epoch_rec *next;
+    uint64_t    seen;       /*  reclaimer:  qseq as of its last scan  */
+    uint64_t    seen_at;    /*  reclaimer:  epoch of that scan  */
+    uint64_t    safe;       /*  reclaimer:  newest epoch it has left behind  */
+};
+
+/*  the shared enter / exit thunk,  one per process  */
+struct __epoch_thunk {
+    uint32_t    tp_mrs;
+    uintptr_t   rec;        /*  struct __epoch_rec,  off tp                */
+    struct __ctx_stub reg;  /*  called once a thread's rec is new,  pc set
+                             *  by the builder                            */
+    size_t      exit;       /*  out:  byte offset of the exit half        */
+};
+
+struct __entry_stub {
+    uintptr_t   detour;
+    uintptr_t   orig;       /*  trampoline,  where a closed gate goes  */
+    uintptr_t   gate;       /*  8-byte aligned u64,  0 = ungated       */
+    unsigned    bit;
+    uintptr_t   slot;       /*  8-byte aligned detour ptr,  0 = b detour  */
+    const uint64_t *ids;    /*  task:  current's id is one of these       */
+    size_t      n_ids;
+    uint32_t    hop[__STUB_MAX_HOPS];   /*  loads off current,  last = id */
+    size_t      n_hops;
+    int         id_w;       /*  last load is 32-bit                       */
+    uintptr_t   epoch;      /*  epoch:  the thunk's enter,  0 = untracked */
+    uintptr_t   epoch_exit; /*  epoch:  and its exit                      */
+    int         thread;
+    uint32_t    tp_mrs;     /*  mrs x17, <thread / cpu base>              */
+    uintptr_t   mask;       /*  thread:  u64 mask,  offset from that base */
+    uintptr_t   count;      /*  u32 countdown,  offset from that base     */
+    uint32_t    period;     /*  mean calls per detour run,  0 = every one */
+    const struct silkhook_pred *pred;
+    size_t      n_pred;     /*  0 = every call matches                    */
+    int         ret;        /*  mov x0, #value ; ret  instead of detour   */
+    uint64_t    value;      /*  w/ a slot,  x0 is loaded from it instead  */
+};
+
+#define __STUB_PERIOD_MAX   (1u << 24)
+
+/*  __trampoline_emit builder,  ctx is a struct __entry_stub  */
+int __stub_emit_entry(struct __codebuf *cb, void *ctx);
+
+/*  __trampoline_emit builder,  ctx is a struct __epoch_thunk  */
+int __stub_emit_epoch_thunk(struct __codebuf *cb, void *ctx);
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * probe stub
+ *
+ * reached by a b that replaced one instr mid function:
+ *
+ *   ┌──────────────────────────────┐
+ *   │ <ctx call>  fn(regs, arg)    │  see ctx stub above
+ *   │ <reloc'd instr>              │  w/o x16 / x17,  see __reloc_probe
+ *   │ b    pc + 4                  │  always a plain b,  x16 may be live
+ *   └──────────────────────────────┘
+ *
+ * no bti c - nothing branches here indirectly
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+struct __probe_stub {
+    uintptr_t   pc;         /*  probed instr addr  */
+    uint32_t    instr;      /*  what used to be there  */
+    uintptr_t   fn;
+    uintptr_t   arg;
+    int         bti;        /*  pc is on a guarded page  */
+    int         fp;         /*  __STUB_FP_*  */
+};
+
+/*  __trampoline_emit builder,  ctx is a struct __probe_stub  */
+int __stub_emit_probe(struct __codebuf *cb, void *ctx);
+
+
+#endif /* _SILKHOOK_STUB_H_ */
@@ -7,6 +7,7 @@
 
 #include "trampoline.h"
 #include "assembler.h"
+#include "flush.h"
 #include "../include/types.h"
 #include "../include/status.h"
 #include "../platform/memory.h"
@@ -22,53 +23,362 @@
 
 #ifdef __KERNEL__
     #include <linux/string.h>
+    #include <linux/slab.h>
+    #include <linux/spinlock.h>
 #else
     #include <string.h>
+    #include <stdlib.h>
+    #include <pthread.h>
 #endif
 
 
+/* ─────────────────────────────────────────────────────────────────────────────
+ * slot pool
+ *
+ * trampolines  (and generated stubs)  r carved out of __POOL_CHUNK
+ * sized exec chunks,  one size class per chunk.   chunk metadata lives
+ * off to the side so the exec pages only ever hold code
+ *
+ *   chunk (4 KiB,  cls 32):
+ *   ┌────────┬────────┬────────┬─────┬────────┐
+ *   │ slot 0 │ slot 1 │ slot 2 │ ... │ slot N │   used[] bit per slot
+ *   └────────┴────────┴────────┴─────┴────────┘
+ *
+ * alloc prefers a chunk within b reach of the hook targ,  so the
+ * jump back can be a single b.   empty chunks go back to the platform
+ *
+ * PACKED drops the reach preference and grows the pool from its top,
+ * so every trampoline sits in one contiguous run of pages - after a
+ * fork that's the fewest pages a child can end up owning privately
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define __POOL_CHUNK        4096u
+#define __POOL_MIN_CLS      32u
+#define __POOL_MAX_CLS      1024u
+#define __POOL_MAX_SLOTS    (__POOL_CHUNK / __POOL_MIN_CLS)
+#define __POOL_WORDS        ((__POOL_MAX_SLOTS + 63) / 64)
+
+#ifdef SILKHOOK_ARCH_ARM64
+    #define __POOL_NEAR     ((uintptr_t) __B_RANGE - __POOL_CHUNK)
+#else
+    #define __POOL_NEAR     ((uintptr_t) 0)
+#endif
+
+struct __pool_chunk {
+    struct __pool_chunk *next;
+    uintptr_t           base;
+    size_t              cls;
+    size_t              n_used;
+    uint64_t            used[__POOL_WORDS];
+};
+
+/*  trampolines stop @ SILKHOOK_TRAMPOLINE_MAX,  the rest is for stubs  */
+static const size_t __pool_cls[] = { 32u, 64u, 128u, 256u, 512u, 1024u };
+
+#define __POOL_N_CLS    (sizeof(__pool_cls) / sizeof(__pool_cls[0]))
+
+static struct __pool_chunk *__pool        = NULL;
+static int                  __pool_layout = SILKHOOK_TRAMP_NEAR;
+static uintptr_t            __pool_top    = 0;
+
+#ifdef __KERNEL__
+    static DEFINE_SPINLOCK(__pool_lock);
+    #define __POOL_LOCK(f)      spin_lock_irqsave(&__pool_lock, (f))
+    #define __POOL_UNLOCK(f)    spin_unlock_irqrestore(&__pool_lock, (f))
+    #define __POOL_META_ALLOC() kzalloc(sizeof(struct __pool_chunk), GFP_KERNEL)
+    #define __POOL_META_FREE(c) kfree(c)
+#else
+    static pthread_mutex_t __pool_lock = PTHREAD_MUTEX_INITIALIZER;
+    #define __POOL_LOCK(f)      ((void) (f), pthread_mutex_lock(&__pool_lock))
+    #define __POOL_UNLOCK(f)    ((void) (f), pthread_mutex_unlock(&__pool_lock))
+    #define __POOL_META_ALLOC() calloc(1, sizeof(struct __pool_chunk))
+    #define __POOL_META_FREE(c) free(c)
+#endif
+
+static int __pool_near(const struct __pool_chunk *c, uintptr_t hint)
+{
+    uintptr_t d;
+
+    if (!__POOL_NEAR || __pool_layout == SILKHOOK_TRAMP_PACKED)
+        return 1;
+
+    d = c->base > hint ? c->base - hint : hint - c->base;
+    return d < __POOL_NEAR;
+}
+
+/*  pages a chunk really maps  (> __POOL_CHUNK on 16k / 64k kernels)  */
+static uintptr_t __pool_chunk_span(void)
+{
+    uintptr_t ps = (uintptr_t) __mem_page_size();
+
+    return (__POOL_CHUNK + ps - 1) & ~(ps - 1);
+}
+
+static uintptr_t __pool_take(struct __pool_chunk *c)
+{
+    size_t n = __POOL_CHUNK / c->cls;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (!(c->used[i / 64] & (1ull << (i % 64))))
+        {
+            c->used[i / 64] |= 1ull << (i % 64);
+            c->n_used++;
+            return c->base + (i * c->cls);
+        }
+    }
+
+    return 0;
+}
+
+static uintptr_t __pool_try(size_t cls, uintptr_t hint, int near)
+{
+    struct __pool_chunk *c;
+
+    for (c = __pool; c; c = c->next)
+    {
+        if (c->cls != cls || c->n_used == __POOL_CHUNK / cls)
+            continue;
+
+        if (!near || __pool_near(c, hint))
+            return __pool_take(c);
+    }
+
+    return 0;
+}
+
+/*  near chunk w/ room  >  fresh near chunk  >  any chunk w/ room  >  fresh  */
+static int __pool_alloc(size_t cls, uintptr_t hint, uintptr_t *out)
+{
+    struct __pool_chunk *c;
+    unsigned long flags = 0;
+    uintptr_t top;
+    int packed;
+    void *mem;
+    int r;
+
+    __POOL_LOCK(flags);
+    *out   = __pool_try(cls, hint, 1);
+    packed = __pool_layout == SILKHOOK_TRAMP_PACKED;
+    top    = __pool_top;
+    __POOL_UNLOCK(flags);
+
+    if (*out)
+        return SILKHOOK_OK;
+
+    /*  chunk alloc may sleep / mmap,  keep it outside the lock  */
+    c = __POOL_META_ALLOC();
+    if (!c)
+        return SILKHOOK_ERR_NOMEM;
+
+    if (!packed)
+        r = __mem_alloc_exec_near(hint, __POOL_NEAR, __POOL_CHUNK, &mem);
+    else if (top)
+        r = __mem_alloc_exec_near(top, __POOL_CHUNK, __POOL_CHUNK, &mem);
+    else
+        r = __mem_alloc_exec(__POOL_CHUNK, &mem);
+
+    if (r != SILKHOOK_OK)
+    {
+        __POOL_META_FREE(c);
+        return r;
+    }
+
+    c->base = (uintptr_t) mem;
+    c->cls  = cls;
+
+    __POOL_LOCK(flags);
+
+    /*  couldn't land near,  don't grow the pool if there's room already  */
+    if (!__pool_near(c, hint) && (*out = __pool_try(cls, hint, 0)))
+    {
+        __POOL_UNLOCK(flags);
+        __mem_free(mem, __POOL_CHUNK);
+        __POOL_META_FREE(c);
+        return SILKHOOK_OK;
+    }
+
+    c->next = __pool;
+    __pool  = c;
+    *out    = __pool_take(c);
+
+    if (c->base + __pool_chunk_span() > __pool_top)
+        __pool_top = c->base + __pool_chunk_span();
+    __POOL_UNLOCK(flags);
+
+    return SILKHOOK_OK;
+}
+
+static int __pool_free(uintptr_t slot)
+{
+    struct __pool_chunk **pp, *c;
+    unsigned long flags = 0;
+    size_t i;
+
+    __POOL_LOCK(flags);
+
+    for (pp = &__pool; (c = *pp); pp = &c->next)
+        if (slot >= c->base && slot < c->base + __POOL_CHUNK)
+            break;
+
+    if (!c || (slot - c->base) % c->cls)
+    {
+        __POOL_UNLOCK(flags);
+        return SILKHOOK_ERR_INVAL;
+    }
+
+    i = (slot - c->base) / c->cls;
+    c->used[i / 64] &= ~(1ull << (i % 64));
+
+    if (--c->n_used)
+    {
+        __POOL_UNLOCK(flags);
+        return SILKHOOK_OK;
+    }
+
+    *pp = c->next;
+    __POOL_UNLOCK(flags);
+
+    __flush_forget(c->base, c->base + __POOL_CHUNK);
+    __mem_free((void *) c->base, __POOL_CHUNK);
+    __POOL_META_FREE(c);
+    return SILKHOOK_OK;
+}
+
+
 /* ─────────────────────────────────────────────────────────────────────────────
  * trampoline creation
+ *
+ * arm64 takes the smallest slot class the code fits in:
+ *
+ *   plain prologue,  slot in b reach:   bti c | 4 instrs | b back     (24)
+ *   plain prologue,  within 4 GB:       bti c | 4 instrs | adrp jmp   (32)
+ *   pc-rel instrs:                      expanded per __reloc          (<= 256)
+ *
+ * abs jmp lits go in a pool @ the slot tail,  so a slot w/ lits is
+ * always >= 2 cache lines - lits in the last,  code in the ones before
+ * it.   code that doesn't leave the last line free takes a bigger class:
+ *
+ *   128 byte slot:
+ *   ┌─────────────────────────────┬─────────────────────────────┐
+ *   │ bti c | code ... | ldr/br   │ udf ...         | .quad ... │
+ *   └─────────────────────────────┴─────────────────────────────┘
+ *   ^ line 0                      ^ line 1
+ *
+ * the code depends on the slot addr  (b reach,  pc-rel re-encoding),  so
+ * every class gets a trial build @ a real slot.   on overflow the slot
+ * goes back and the next class up is tried
  * ───────────────────────────────────────────────────────────────────────────── */
 
+#ifdef SILKHOOK_ARCH_ARM64
+static int __trampoline_build(uintptr_t targ, size_t n_bytes, uintptr_t slot,
+                              int bti, struct __codebuf *cb)
+{
+    const uint32_t *src = (const uint32_t *) targ;
+    size_t n_instr = n_bytes / SILKHOOK_INSTR_SIZE;
+    size_t i = 0;
+    int status;
+
+    __CODEBUF_INIT(cb, cb->buf, cb->cap, slot);
+    cb->bti = bti;
+
+    __CODEBUF_EMIT(cb, __BTI_C());
+
+    /*  orig pad is redundant behind ours.   paciasp stays - it signs lr
+     *  against the same sp the orig autiasp checks it w/  */
+    if (__IS_BTI(src[0]))
+        i = 1;
+
+    for (; i < n_instr; i++)
+    {
+        status = __reloc(src[i], targ + (i * SILKHOOK_INSTR_SIZE), cb);
+        if (status != SILKHOOK_OK)
+            return status;
+    }
+
+    __EMIT_JMP(cb, targ + n_bytes);
+
+    /*  full buf means the emitter may have dropped instrs  */
+    if (cb->len == cb->cap)
+        return SILKHOOK_ERR_NOMEM;
+
+    return SILKHOOK_OK;
+}
+
+static int __trampoline_fits(const struct __codebuf *cb, size_t cls)
+{
+    if (!cb->n_lits)
+        return __CODEBUF_SIZE(cb) <= cls;
+
+    return cls >= 2 * SILKHOOK_CACHE_LINE &&
+           __CODEBUF_SIZE(cb) <= cls - SILKHOOK_CACHE_LINE &&
+           __CODEBUF_LIT_SIZE(cb) <= SILKHOOK_CACHE_LINE;
+}
+#endif
+
 int __trampoline_create(uintptr_t targ, size_t n_bytes, uintptr_t *out, int is_thumb)
 {
+    uintptr_t slot = 0;
     void *mem = NULL;
-    uint32_t code[SILKHOOK_TRAMPOLINE_MAX / 4];
-    struct __codebuf cb;
     int status;
 
-    status = __mem_alloc_exec(SILKHOOK_TRAMPOLINE_MAX, &mem);
-    if (status != SILKHOOK_OK)
-        return status;
-
     #ifdef SILKHOOK_ARCH_ARM64
     {
-        __CODEBUF_INIT(&cb, code, sizeof(code) / sizeof(code[0]), (uintptr_t)mem);
+        uint32_t code[(SILKHOOK_TRAMPOLINE_MAX * 2) / 4];
+        struct __codebuf cb;
+        size_t len = 0, k;
+        int bti = __mem_guarded(targ);
+
+        (void) is_thumb;
+        (void) mem;
 
-        __CODEBUF_EMIT(&cb, __BTI_C());
+        status = __reloc_check((const uint32_t *) targ, n_bytes / SILKHOOK_INSTR_SIZE, targ);
+        if (status != SILKHOOK_OK)
+            return status;
 
-        size_t n_instr = n_bytes / SILKHOOK_INSTR_SIZE;
-        const uint32_t *src = (const uint32_t *)targ;
+        cb.buf = code;
+        cb.cap = sizeof(code) / sizeof(code[0]);
 
-        for (size_t i = 0; i < n_instr; i++)
+        for (k = 0; k < __POOL_N_CLS && __pool_cls[k] <= SILKHOOK_TRAMPOLINE_MAX; k++)
         {
-            status = __reloc(src[i], targ + (i * SILKHOOK_INSTR_SIZE), &cb);
+            status = __pool_alloc(__pool_cls[k], targ, &slot);
+            if (status != SILKHOOK_OK)
+                return status;
+
+            status = __trampoline_build(targ, n_bytes, slot, bti, &cb);
+            if (status == SILKHOOK_OK && __trampoline_fits(&cb, __pool_cls[k]))
+                break;
+
+            __pool_free(slot);
+
             if (status != SILKHOOK_OK)
-            {
-                __mem_free(mem, SILKHOOK_TRAMPOLINE_MAX);
                 return status;
-            }
         }
 
+        if (k == __POOL_N_CLS || __pool_cls[k] > SILKHOOK_TRAMPOLINE_MAX)
+            return SILKHOOK_ERR_NOMEM;
 
-        __EMIT_ABS_JMP(&cb, targ + n_bytes);
+        /*  lits @ the slot tail  */
+        len = __codebuf_finalize(&cb, (__pool_cls[k] - __CODEBUF_LIT_SIZE(&cb)) / 4);
+        if (!len)
+        {
+            __pool_free(slot);
+            return SILKHOOK_ERR_NOMEM;
+        }
 
-        memcpy(mem, code, __CODEBUF_SIZE(&cb));
-        __flush_icache(mem, __CODEBUF_SIZE(&cb));
+        memcpy(__mem_writable((void *) slot), code, len);
+        __flush_code((void *) slot, len);
     }
     #else /*  SILKHOOK_ARCH_ARM32  */
-        (void) is_thumb;
+        uint32_t code[SILKHOOK_TRAMPOLINE_MAX / 4];
+        struct __codebuf cb;
+
+        status = __pool_alloc(SILKHOOK_TRAMPOLINE_MAX, targ, &slot);
+        if (status != SILKHOOK_OK)
+            return status;
+
+        mem = (void *) slot;
 
         __CODEBUF_INIT(&cb, code, sizeof(code) / sizeof(code[0]), (uintptr_t) mem);
 
@@ -83,15 +393,15 @@ int __trampoline_create(uintptr_t targ, size_t n_bytes, uintptr_t *out, int is_t
             status = __thumb_reloc((const uint16_t *)targ, n_bytes, targ, &tcb);
             if (status != SILKHOOK_OK)
             {
-                __mem_free(mem, SILKHOOK_TRAMPOLINE_MAX);
+                __pool_free(slot);
                 return status;
             }
 
             /* Jump back with thumb bit */
             __thumb_emit_abs_jmp(&tcb, (targ + n_bytes) | 1);
 
-            memcpy(mem, thumb_code, __THUMB_CODEBUF_SIZE(&tcb));
-            __flush_icache(mem, __THUMB_CODEBUF_SIZE(&tcb));
+            memcpy(__mem_writable(mem), thumb_code, __THUMB_CODEBUF_SIZE(&tcb));
+            __flush_code(mem, __THUMB_CODEBUF_SIZE(&tcb));
         }
         else {
             size_t n_instr = n_bytes / SILKHOOK_INSTR_SIZE;
@@ -102,7 +412,7 @@ int __trampoline_create(uintptr_t targ, size_t n_bytes, uintptr_t *out, int is_t
                 status = __arm32_reloc(src[i], targ + (i * SILKHOOK_INSTR_SIZE), &cb);
                 if (status != SILKHOOK_OK)
                 {
-                    __mem_free(mem, SILKHOOK_TRAMPOLINE_MAX);
+                    __pool_free(slot);
                     return status;
                 }
             }
@@ -112,19 +422,125 @@ int __trampoline_create(uintptr_t targ, size_t n_bytes, uintptr_t *out, int is_t
             __CODEBUF_EMIT(&cb, (uint32_t) (targ + n_bytes));  /* .long addr         */
             __CODEBUF_EMIT(&cb, 0xE51FF00Cu);                  /* ldr pc, [pc, #-12] */
 
-            memcpy(mem, code, __CODEBUF_SIZE(&cb));
-            __flush_icache(mem, __CODEBUF_SIZE(&cb));
+            memcpy(__mem_writable(mem), code, __CODEBUF_SIZE(&cb));
+            __flush_code(mem, __CODEBUF_SIZE(&cb));
         }
     #endif
 
-    *out = (uintptr_t) mem;
+    *out = slot;
     return SILKHOOK_OK;
 }
 
+#ifdef SILKHOOK_ARCH_ARM64
+/*  entered by b,  no pad.   br x16 lands on dest's own bti c  */
+int __trampoline_veneer(uintptr_t from, uintptr_t dest, uintptr_t *out)
+{
+    uint32_t code[4];
+    uintptr_t slot;
+    int status;
+
+    status = __pool_alloc(__pool_cls[0], from, &slot);
+    if (status != SILKHOOK_OK)
+        return status;
+
+    if (!__B_REACH(from, slot))
+    {
+        __pool_free(slot);
+        return SILKHOOK_ERR_NOMEM;
+    }
+
+    __ABS_JMP(code, dest);
+    memcpy(__mem_writable((void *) slot), code, sizeof(code));
+    __flush_code((void *) slot, sizeof(code));
+
+    *out = slot;
+    return SILKHOOK_OK;
+}
+
+/*  same trial build per class as trampolines,  lits go right after
+ *  the code - stubs r run once per call,  not per instr  */
+int __trampoline_emit(uintptr_t hint, __trampoline_build_fn build, void *ctx, uintptr_t *out)
+{
+    uint32_t code[__POOL_MAX_CLS / 4];
+    struct __codebuf cb;
+    uintptr_t slot = 0;
+    size_t len = 0, k;
+    int status;
+
+    if (!build || !out)
+        return SILKHOOK_ERR_INVAL;
+
+    for (k = 0; k < __POOL_N_CLS; k++)
+    {
+        status = __pool_alloc(__pool_cls[k], hint, &slot);
+        if (status != SILKHOOK_OK)
+            return status;
+
+        __CODEBUF_INIT(&cb, code, __pool_cls[k] / 4, slot);
+
+        status = build(&cb, ctx);
+        if (status == SILKHOOK_OK && cb.len < cb.cap &&
+            (len = __codebuf_finalize(&cb, (cb.len + 1) & ~(size_t) 1)))
+            break;
+
+        __pool_free(slot);
+
+        if (status != SILKHOOK_OK)
+            return status;
+    }
+
+    if (k == __POOL_N_CLS)
+        return SILKHOOK_ERR_NOMEM;
+
+    memcpy(__mem_writable((void *) slot), code, len);
+    __flush_code((void *) slot, len);
+
+    *out = slot;
+    return SILKHOOK_OK;
+}
+#endif
+
+int __trampoline_set_layout(int layout)
+{
+    unsigned long flags = 0;
+
+    if (layout != SILKHOOK_TRAMP_NEAR && layout != SILKHOOK_TRAMP_PACKED)
+        return SILKHOOK_ERR_INVAL;
+
+    __POOL_LOCK(flags);
+    __pool_layout = layout;
+    __POOL_UNLOCK(flags);
+    return SILKHOOK_OK;
+}
+
+size_t __trampoline_pages(void)
+{
+    struct __pool_chunk *c;
+    unsigned long flags = 0;
+    size_t n = 0;
+
+    __POOL_LOCK(flags);
+    for (c = __pool; c; c = c->next)
+        n++;
+    __POOL_UNLOCK(flags);
+
+    return n * (__pool_chunk_span() / __mem_page_size());
+}
+
 int __trampoline_destroy(uintptr_t tramp)
 {
     if (!tramp)
         return SILKHOOK_ERR_INVAL;
 
-    return __mem_free((void *)tramp, SILKHOOK_TRAMPOLINE_MAX);
+    return __pool_free(tramp);
 }
+
+#ifndef __KERNEL__
+void __trampoline_fork_lock(int take)
+{
+    if (take)
+        pthread_mutex_lock(&__pool_lock);
+    else
+        pthread_mutex_unlock(&__pool_lock);
+}
+#endif
@@ -19,15 +19,50 @@
 /* ─────────────────────────────────────────────────────────────────────────────
  * trampoline layout
  *
- *   [0.. n]   reloc'd orig instrs
- *   [n+1]     ldr x16, [pc, #8]
+ *   [0]       bti c
+ *   [1.. n]   reloc'd orig instrs
+ *   [n+1]     b   targ + HOOK_N_BYTE              <- slot in b reach
+ *
+ *   or:                                           <- within 4 GB
+ *   [n+1]     adrp x16, targ + HOOK_N_BYTE
+ *   [n+2]     add  x16, x16, lo12
+ *   [n+3]     br   x16
+ *
+ *   or:
+ *   [n+1]     ldr x16, =lit
  *   [n+2]     br  x16
- *   [n+3]     <targ + HOOK_N_BYTE low>
- *   [n+4]     <targ + HOOK_N_BYTE high>
+ *   ...
+ *   [tail]    lit: <targ + HOOK_N_BYTE>           <- own cache line
+ *
+ * slots come from a pooled 32 .. 256 byte class,  smallest fit wins.
+ * a leading bti in the orig instrs is dropped  (the slot has its own),
+ * on bti guarded targs the jmps back r b or ret x16  (see arch.h)
  * ───────────────────────────────────────────────────────────────────────────── */
 
 int __trampoline_create(uintptr_t targ, size_t n_bytes, uintptr_t *out, int is_thumb);
 int __trampoline_destroy(uintptr_t tramp);
 
+/*  ldr / br x16 to dest in a slot b reachable from `from`,  freed w/
+ *  __trampoline_destroy  */
+int __trampoline_veneer(uintptr_t from, uintptr_t dest, uintptr_t *out);
+
+/*  generated stubs out of the same pool.   build is re-run @ each slot
+ *  class it's tried in  (code may depend on the slot addr),  up to 1024
+ *  bytes incl. lits   */
+struct __codebuf;
+typedef int (*__trampoline_build_fn)(struct __codebuf *cb, void *ctx);
+
+int __trampoline_emit(uintptr_t hint, __trampoline_build_fn build, void *ctx, uintptr_t *out);
+
+/*  enum silkhook_tramp_layout,  applies to chunks allocated after  */
+int __trampoline_set_layout(int layout);
+
+/*  exec pages currently held by the pool  */
+size_t __trampoline_pages(void);
+
+#ifndef __KERNEL__
+void __trampoline_fork_lock(int take);
+#endif
+
 
 #endif /* _SILKHOOK_TRAMPOLINE_H_ */
@@ -8,13 +8,21 @@
 #include <linux/spinlock.h>
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
 #include <asm/debug-monitors.h>
 #include <asm/ptrace.h>
 
 #include "elb.h"
 #include "memory.h"
 #include "ksyms.h"
+#include "sync.h"
+#include "../../include/types.h"
 #include "../../include/status.h"
+#include "../../internal/trampoline.h"
+#include "../../internal/flush.h"
+#include "../../internal/relocator.h"
+#include "../../internal/stub.h"
 
 
 /* ─────────────────────────────────────────────────────────────────────────────
@@ -63,58 +71,267 @@ static void __elb_remove(struct silkhook_elb_hook *h)
 
 
 /* ─────────────────────────────────────────────────────────────────────────────
- * simple instr emu
+ * out-of-line slot
  *
- * overwrote the orig instr with brk,  need to emulate it
- * only handles common prologue instr for now
+ * overwrote the orig instr with brk,  so instead of emulating it we
+ * run a reloc'd copy from a per-hook slot and b back to targ + 4
+ *
+ *   slot = __trampoline_emit(targ, __elb_slot_emit, h)
+ *
+ *   ┌──────────────────────┐
+ *   │ <reloc'd orig instr> │  <- __reloc_probe,  no x16 / x17
+ *   │ b    targ + 4        │
+ *   └──────────────────────┘
+ *
+ * the handler just points elr_el1 @ the slot,  eret runs it
+ * directly - no single-step,  no 2nd exception per hit.   it clears
+ * BTYPE first,  so the slot needs no landing pad
+ *
+ * targ can be anywhere in a funct,  x16 / x17 may be live there - so
+ * the instr is relocated w/o scratch regs and the way back is a plain
+ * b.   an instr that'd need one,  or a slot out of b reach,  fails
+ * install w/ SILKHOOK_ERR_INSTR / SILKHOOK_ERR_NOMEM
  * ───────────────────────────────────────────────────────────────────────────── */
 
+static int __elb_slot_emit(struct __codebuf *cb, void *ctx)
+{
+    struct silkhook_elb_hook *h = ctx;
+    uintptr_t targ = (uintptr_t) h->targ;
+    uintptr_t pc;
+    int r;
+
+    r = __reloc_probe(h->orig_instr, targ, cb);
+    if (r != SILKHOOK_OK)
+        return r;
 
-static void __elb_emulate_instr(struct pt_regs *regs, uint32_t instr)
+    pc = __CODEBUF_PC(cb);
+    if (!__B_REACH(pc, targ + SILKHOOK_INSTR_SIZE))
+        return SILKHOOK_ERR_NOMEM;
+    __CODEBUF_EMIT(cb, __B(targ + SILKHOOK_INSTR_SIZE - pc));
+    return SILKHOOK_OK;
+}
+
+static int __elb_slot_create(struct silkhook_elb_hook *h)
 {
-    unsigned int rd, rn, rm;
+    return __trampoline_emit((uintptr_t) h->targ, __elb_slot_emit, h, &h->slot);
+}
 
-    /*  nop - d503201f  */
-    if (instr == 0xD503201F)
-            return;
+static void __elb_slot_destroy(struct silkhook_elb_hook *h)
+{
+    if (h->slot)
+        __trampoline_destroy(h->slot);
+    h->slot = 0;
+}
 
-    /*  hint instrs  (pac, bti, etc) - d503xxxx  */
-    if ((instr & 0xFFFFF000) == 0xD5030000)
-        return;
 
-    /* mov xd, xn  (orr xd, xzr, xn) - aa0003e0 | (rn << 16) | rd  */
-    if ((instr & 0xFF0003E0) == 0xAA0003E0)
+/* ─────────────────────────────────────────────────────────────────────────────
+ * hot probe promotion
+ *
+ * brk hits are counted,  crossing SILKHOOK_ELB_HOT_HITS kicks a pass
+ * from a workqueue.   a probe is promoted only if:
+ *
+ *   - targ is a funct entry w/ room for the covered instrs  (kallsyms)
+ *   - __reloc_check() passes on orig instr + the 3 after it
+ *   - nothing else in the funct branches into targ + 4 .. targ + 12,
+ *     it'd land mid ldr / br / lit,  and it has no br  (jump tables)
+ *   - w/ bti on,  targ isn't a landing pad  (ldr x16 can't stand in
+ *     for the bti c / paciasp indirect callers land on)
+ *
+ * optimized:  0 = brk,  1 = branch hook,  -1 = rejected (stays brk)
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static DEFINE_MUTEX(__elb_opt_mutex);
+
+static int (*__kallsyms_size_off)(unsigned long, unsigned long *,
+                                  unsigned long *) = NULL;
+
+static void __elb_optimize_fn(struct work_struct *work);
+static DECLARE_WORK(__elb_opt_work, __elb_optimize_fn);
+
+static int __elb_can_promote(struct silkhook_elb_hook *h)
+{
+    uintptr_t targ = (uintptr_t) h->targ;
+    unsigned long size, off;
+
+    if (!__kallsyms_size_off || !__kallsyms_size_off(targ, &size, &off))
+        return 0;
+
+    if (off != 0 || size < SILKHOOK_ELB_COVER * SILKHOOK_INSTR_SIZE)
+        return 0;
+
+    if (__reloc_scan((const uint32_t *) targ, size / SILKHOOK_INSTR_SIZE, targ,
+                     targ + SILKHOOK_INSTR_SIZE,
+                     targ + SILKHOOK_ELB_COVER * SILKHOOK_INSTR_SIZE) != SILKHOOK_OK)
+        return 0;
+
+    /*  targ[0] is our brk,  orig lives in the hook  */
+    h->covered[0] = h->orig_instr;
+    memcpy(&h->covered[1], (uint32_t *) targ + 1,
+           (SILKHOOK_ELB_COVER - 1) * SILKHOOK_INSTR_SIZE);
+
+    if (__mem_guarded(targ) && __IS_LANDING_PAD(h->covered[0]))
+        return 0;
+
+    return __reloc_check(h->covered, SILKHOOK_ELB_COVER, targ) == SILKHOOK_OK;
+}
+
+static int __elb_stub_create(struct silkhook_elb_hook *h)
+{
+    uint32_t code[__STUB_MAX / 4];
+    uintptr_t targ = (uintptr_t) h->targ;
+    struct __codebuf cb;
+    struct __ctx_stub s = {
+        .frame  = ALIGN(sizeof(struct pt_regs), 16),
+        .pc     = targ,
+        .pstate = PSR_MODE_EL1h,
+        .fn     = (uintptr_t) h->handler,
+        .arg    = (uintptr_t) h,
+    };
+    uintptr_t resume;
+    size_t len;
+    void *mem;
+    int i, r;
+
+    if (s.frame > __STUB_FRAME_MAX)
+        return SILKHOOK_ERR_INVAL;
+
+    r = __mem_alloc_exec(__STUB_MAX, &mem);
+    if (r != SILKHOOK_OK)
+        return r;
+
+    __CODEBUF_INIT(&cb, code, ARRAY_SIZE(code), (uintptr_t) mem);
+    cb.bti = __mem_guarded(targ);
+
+    __CODEBUF_EMIT(&cb, __BTI_C());
+    __stub_emit_ctx_call(&cb, &s);
+
+    /*  brk hits resume here while the promotion is pending  */
+    resume = (uintptr_t) mem + __CODEBUF_SIZE(&cb);
+
+    for (i = 0; i < SILKHOOK_ELB_COVER; i++)
+        __reloc(h->covered[i], targ + (i * SILKHOOK_INSTR_SIZE), &cb);
+
+    __EMIT_JMP(&cb, targ + (SILKHOOK_ELB_COVER * SILKHOOK_INSTR_SIZE));
+
+    /*  lit pool on the next line after the code  */
+    len = cb.len < cb.cap
+        ? __codebuf_finalize(&cb, ALIGN(__CODEBUF_SIZE(&cb), SILKHOOK_CACHE_LINE) / 4)
+        : 0;
+    if (!len)
+    {
+        __mem_free(mem, __STUB_MAX);
+        return SILKHOOK_ERR_NOMEM;
+    }
+
+    memcpy(mem, code, len);
+    __flush_icache(mem, len);
+
+    h->stub   = (uintptr_t) mem;
+    h->resume = resume;
+    return SILKHOOK_OK;
+}
+
+static void __elb_stub_destroy(struct silkhook_elb_hook *h)
+{
+    if (h->stub)
+        __mem_free((void *) h->stub, __STUB_MAX);
+    h->stub = 0;
+}
+
+/*  point brk hits @ the stub's resume  (or back @ the slot w/ 0)  */
+static void __elb_divert(struct silkhook_elb_hook *h, uintptr_t to)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&__elb_lock, flags);
+    WRITE_ONCE(h->divert, to);
+    spin_unlock_irqrestore(&__elb_lock, flags);
+}
+
+int silkhook__elb_optimize(void)
+{
+    struct silkhook_elb_hook *cand[SILKHOOK_ELB_OPT_BATCH];
+    struct silkhook_sync_ctx  ctx[SILKHOOK_ELB_OPT_BATCH];
+    uint32_t code[SILKHOOK_ELB_OPT_BATCH][SILKHOOK_ELB_COVER];
+    struct silkhook_elb_hook *h;
+    unsigned long flags;
+    size_t n = 0, m = 0, i;
+    int r;
+
+    mutex_lock(&__elb_opt_mutex);
+
+    spin_lock_irqsave(&__elb_lock, flags);
+    for (h = __elb_hooks; h && n < SILKHOOK_ELB_OPT_BATCH; h = h->next)
+        if (!h->optimized && atomic_long_read(&h->hits) >= SILKHOOK_ELB_HOT_HITS)
+            cand[n++] = h;
+    spin_unlock_irqrestore(&__elb_lock, flags);
+
+    for (i = 0; i < n; i++)
     {
-        rd =  instr        & 0x1F;
-        rn = (instr >> 16) & 0x1F;
+        h = cand[i];
 
-        if (rd < 31)
+        if (!__elb_can_promote(h) || __elb_stub_create(h) != SILKHOOK_OK)
         {
-            if (rn == 31)
-                regs->regs[rd] = 0;
-            else if (rn < 31)
-                regs->regs[rd] = regs->regs[rn];
-            else if (rn == 30)
-                regs->regs[rd] = regs->regs[30];
+            h->optimized = -1;
+            continue;
         }
-        return;
+
+        __ABS_JMP(code[m], h->stub);
+        ctx[m].dst = h->targ;
+        ctx[m].src = code[m];
+        ctx[m].len = sizeof(code[m]);
+        cand[m++]  = h;
     }
 
-    /*  mov xd, #imm (movz)  - d28xxxxx  */
-    if ((instr & 0xFF800000) == 0xD2800000)
+    if (!m)
     {
-        rd = instr & 0x1F;
-        uint16_t imm = (instr >> 5) & 0xFFFF;
-        if (rd < 31)
-            regs->regs[rd] = imm;
-        return;
+        mutex_unlock(&__elb_opt_mutex);
+        return SILKHOOK_OK;
+    }
+
+    /*  a task in the slot jmps back to targ + 4,  the middle of the new
+     *  ldr / br / lit.   new hits skip the slot from here on,  then the
+     *  ones already in it  (or preempted in targ[1..3] after it)  drain  */
+    for (i = 0; i < m; i++)
+        __elb_divert(cand[i], cand[i]->resume);
+
+    silkhook_sync_tasks();
+
+    /*  one stop_machine for the whole batch  */
+    r = silkhook_patch_sync_n(ctx, m);
+
+    for (i = 0; i < m; i++)
+    {
+        h = cand[i];
+
+        if (ctx[i].result == SILKHOOK_OK)
+        {
+            h->optimized = 1;
+            pr_info("silkhook: [elb] promoted %px -> stub %px (hits=%ld)\n",
+                    h->targ, (void *) h->stub, atomic_long_read(&h->hits));
+        }
+        else {
+            __elb_divert(h, 0);
+            h->optimized = -1;
+        }
+    }
+
+    /*  failed ones:  hits may still be headed into their stub  */
+    if (r != SILKHOOK_OK)
+    {
+        silkhook_sync_tasks();
+        for (i = 0; i < m; i++)
+            if (ctx[i].result != SILKHOOK_OK)
+                __elb_stub_destroy(cand[i]);
     }
 
-    /*  stp x29, x30, [sp, #imm]! - a9bf7bfd patt  */
-    /*    modify stack, for now we just warn user  */
+    mutex_unlock(&__elb_opt_mutex);
+    return r;
+}
 
-    pr_warn_once("silkhook:  [elb]  cannot emulate %08x @ %px, "
-                    "function could misbehave!!\n", instr, (void *) regs->pc);
+static void __elb_optimize_fn(struct work_struct *work)
+{
+    silkhook__elb_optimize();
 }
 
 
@@ -134,23 +351,36 @@ static int __elb_brk_handler(struct pt_regs *regs, unsigned long esr)
     struct silkhook_elb_hook *h;
     unsigned long pc = instruction_pointer(regs);
     unsigned long flags;
+    uintptr_t divert = 0;
 
     spin_lock_irqsave(&__elb_lock, flags);
     h = __elb_find_by_pc(pc);
+    if (h)
+        divert = READ_ONCE(h->divert);
     spin_unlock_irqrestore(&__elb_lock, flags);
 
     if (!h)
         return DBG_HOOK_ERROR;
 
+    if (atomic_long_inc_return(&h->hits) == SILKHOOK_ELB_HOT_HITS)
+        schedule_work(&__elb_opt_work);
+
     /*  call user handler  */
     if (h->handler)
         h->handler(regs, h);
 
-    /*  emulate the orig instr we just overwrote  */
-    __elb_emulate_instr(regs, h->orig_instr);
+    /*  handler redirected us,  respect it  */
+    if (instruction_pointer(regs) != pc)
+        return DBG_HOOK_HANDLED;
 
-    /*  skip past brk  */
-    regs->pc += 4;
+    /*  resume in the slot - runs the orig instr,  then back to targ + 4.
+     *  mid promotion the stub runs all covered instrs instead,  then back
+     *  to targ + 16.   the brk stood in for a landing pad,  so drop BTYPE
+     *  before eret  */
+#ifdef PSR_BTYPE_MASK
+    regs->pstate &= ~PSR_BTYPE_MASK;
+#endif
+    instruction_pointer_set(regs, divert ? divert : h->slot);
 
     return DBG_HOOK_HANDLED;
 }
@@ -192,6 +422,9 @@ int silkhook__elb_init(void)
         return SILKHOOK_ERR_RESOLVE;
     }
 
+    /*  optional - without it probes just stay brk  */
+    __kallsyms_size_off = silkhook_ksym("kallsyms_lookup_size_offset");
+
     __register_kernel_break_hook(&__elb_break_hook);
     __elb_initialised = 1;
 
@@ -207,6 +440,8 @@ void silkhook__elb_exit(void)
     if (__unregister_kernel_break_hook)
         __unregister_kernel_break_hook(&__elb_break_hook);
 
+    cancel_work_sync(&__elb_opt_work);
+
     __elb_initialised = 0;
 
     pr_info("silkhook: elb exited !!!\n");
@@ -218,12 +453,15 @@ void silkhook__elb_exit(void)
  *
  * install:
  *   1.  save orig instr @ targ
- *   2.  write brk #SILKHOOK_BRK_IMM -> targ
- *   3.  add to registry
+ *   2.  build out-of-line slot from it
+ *   3.  write brk #SILKHOOK_BRK_IMM -> targ
+ *   4.  add to registry
  *
  * remove:
- *   1.  restore orig instr
+ *   1.  restore orig instr  (+ covered instrs if promoted)
  *   2.  remove from registry
+ *   3.  wait out tasks still in the slot / stub  (silkhook_sync_tasks)
+ *   4.  free slot / stub
  * ───────────────────────────────────────────────────────────────────────────── */
 
 int silkhook__elb_install(struct silkhook_elb_hook *h, void *targ,
@@ -236,6 +474,14 @@ int silkhook__elb_install(struct silkhook_elb_hook *h, void *targ,
     if (!h || !targ || !handler)
             return SILKHOOK_ERR_INVAL;
 
+    /*  remove couldn't tell when the slot is free  */
+    if (!SILKHOOK_SYNC_TASKS)
+        return SILKHOOK_ERR_STATE;
+
+    /*  brk goes live immediately,  the slot can't wait for a tx commit  */
+    if (__flush_tx_active())
+        return SILKHOOK_ERR_STATE;
+
     if (!__elb_initialised)
     {
         r = silkhook__elb_init();
@@ -251,10 +497,18 @@ int silkhook__elb_install(struct silkhook_elb_hook *h, void *targ,
     /*  save orig instr  */
     memcpy(&h->orig_instr, targ, sizeof(uint32_t));
 
+    /*  reloc it into the slot before the brk goes in  */
+    r = __elb_slot_create(h);
+    if (r != SILKHOOK_OK)
+        return r;
+
     /*  write brk instr  */
     r = __mem_write_text(targ, &brk_instr, sizeof(uint32_t));
     if (r != SILKHOOK_OK)
+    {
+        __elb_slot_destroy(h);
         return r;
+    }
 
     /*  simply add back 2 the registry  */
     spin_lock_irqsave(&__elb_lock, flags);
@@ -263,8 +517,8 @@ int silkhook__elb_install(struct silkhook_elb_hook *h, void *targ,
 
     h->installed = 1;
 
-    pr_info("silkhook: elb hook installed @ %px (orig=%08x) !!!\n",
-            targ, h->orig_instr);
+    pr_info("silkhook: elb hook installed @ %px (orig=%08x slot=%px) !!!\n",
+            targ, h->orig_instr, (void *) h->slot);
 
     return SILKHOOK_OK;
 }
@@ -278,18 +532,37 @@ int silkhook__elb_remove(struct silkhook_elb_hook *h)
     if (!h || !h->installed)
         return SILKHOOK_ERR_INVAL;
 
-    /*  restore orig instr  */
-    r = __mem_write_text(h->targ, &h->orig_instr, sizeof(uint32_t));
+    mutex_lock(&__elb_opt_mutex);
+
+    /*  restore orig instr  (all covered bytes if promoted)  */
+    if (h->optimized == 1)
+        r = silkhook_patch_sync(h->targ, h->covered, sizeof(h->covered));
+    else
+        r = __mem_write_text(h->targ, &h->orig_instr, sizeof(uint32_t));
+
     if (r != SILKHOOK_OK)
+    {
+        mutex_unlock(&__elb_opt_mutex);
         return r;
+    }
 
     /*  remove from registry  */
     spin_lock_irqsave(&__elb_lock, flags);
     __elb_remove(h);
     spin_unlock_irqrestore(&__elb_lock, flags);
 
+    /*  tasks preempted in the slot / stub,  or in the handler on their
+     *  way into it,  have to be out before they go  */
+    silkhook_sync_tasks();
+
+    __elb_stub_destroy(h);
+    __elb_slot_destroy(h);
+    h->divert    = 0;
+    h->optimized = 0;
     h->installed = 0;
 
+    mutex_unlock(&__elb_opt_mutex);
+
     pr_info("silkhook: elb hook removed @ %px !!!\n", h->targ);
 
     return SILKHOOK_OK;
@@ -27,11 +27,43 @@
  *   │  │    {                                              │  │
  *   │  │        ctx = lookup_by_pc(elr_el1);               │  │
  *   │  │        ctx->handler(regs);                        │  │
+ *   │  │        elr_el1 = ctx->slot;                       │  │
  *   │  │        return DBG_HOOK_HANDLED;                   │  │
  *   │  │    }                                              │  │
  *   │  └───────────────────────────────────────────────────┘  │
+ *   │                       │                                 │
+ *   │                       ▼                                 │
+ *   │  ┌───────────────────────────────────────────────────┐  │
+ *   │  │  slot:  (out-of-line,  per hook)                  │  │
+ *   │  │    <reloc'd orig instr>     ◀── no x16 / x17      │  │
+ *   │  │    b     targ + 4           ◀── no 2nd exception  │  │
+ *   │  └───────────────────────────────────────────────────┘  │
  *   └─────────────────────────────────────────────────────────┘
  *
+ * hot probes:
+ *   a brk costs a full sync exception per hit.  once a probe has fired
+ *   SILKHOOK_ELB_HOT_HITS times we try to promote it to a plain branch
+ *   hook - same handler,  called from a generated ctx stub instead:
+ *
+ *     targ:  ldr x16, =stub ; br x16     (16 bytes,  __ABS_JMP)
+ *     stub:  spill pt_regs -> handler(regs, ctx) -> reload
+ *            <reloc'd covered instrs>
+ *            jmp  targ + 16
+ *
+ *   only done when the relocator proves the 16 covered bytes are safe
+ *   and targ is a funct entry.   all promotions in a pass go in with one
+ *   stop_machine.   remove demotes  (restores orig bytes)  transparently
+ *
+ *   before the patch,  brk hits r diverted past the handler call in the
+ *   stub  (covered instrs,  jmp targ + 16)  and a tasks-rcu grace period
+ *   drains whatever already went through the slot - it jmps back to
+ *   targ + 4,  which the patch turns into the middle of the ldr / br
+ *
+ *   NOTE: promoted handlers run in the caller's ctx,  not exception ctx,
+ *         and writes to regs->pc / regs->sp are ignored
+ *   NOTE: the whole funct  (kallsyms size)  is decoded first,  one w/
+ *         a branch into targ[1..3] or any br stays a brk
+ *
  * why?:
  *   - no funct prologue modif
  *   - hook code runs in exception ctx  (like it'll be expected to)
@@ -44,11 +76,16 @@
 #define _SILKHOOK_ELB_H_
 
 #include <linux/types.h>
+#include <linux/atomic.h>
 
 
 #define SILKHOOK_BRK_IMM    0x5148
 #define SILKHOOK_BRK_INSTR  (0xD4200000 | (SILKHOOK_BRK_IMM << 5))
 
+#define SILKHOOK_ELB_HOT_HITS   4096ul
+#define SILKHOOK_ELB_OPT_BATCH  16
+#define SILKHOOK_ELB_COVER      4       /*  instrs covered once promoted  */
+
 
 /* ─────────────────────────────────────────────────────────────────────────────
  * core elb hook context
@@ -65,7 +102,15 @@ struct silkhook_elb_hook
     silkhook_elb_handler_t   handler;
     void                     *priv;
     uint32_t                 orig_instr;
+    uintptr_t                slot;
     int                      installed;
+
+    atomic_long_t            hits;
+    uint32_t                 covered[SILKHOOK_ELB_COVER];
+    uintptr_t                stub;
+    uintptr_t                resume;    /*  stub,  past the handler call  */
+    uintptr_t                divert;    /*  brk eret target,  0 = slot  */
+    int                      optimized;
     struct silkhook_elb_hook *next;
 };
 
@@ -81,5 +126,7 @@ int silkhook__elb_install(struct silkhook_elb_hook *h, void *targ,
                           silkhook_elb_handler_t handler, void *priv);
 int silkhook__elb_remove(struct silkhook_elb_hook *h);
 
+int silkhook__elb_optimize(void);
+
 
 #endif /* _SILKHOOK_ELB_H_ */
@@ -18,7 +18,11 @@
 #include "ich.h"
 #include "ksyms.h"
 #include "memory.h"
+#include "sync.h"
+#include "../../include/types.h"
 #include "../../include/status.h"
+#include "../../internal/trampoline.h"
+#include "../../internal/flush.h"
 
 
 /* ─────────────────────────────────────────────────────────────────────────────
@@ -77,67 +81,17 @@ static inline unsigned int __ich_jitter(struct silkhook_ich_hook *h)
 
 
 /* ─────────────────────────────────────────────────────────────────────────────
- * instr emulation (same as elb)
+ * out-of-line slot (same as elb)
+ *
+ * reloc'd orig instr + jump back to targ + 4,  the handler erets into it
  * ───────────────────────────────────────────────────────────────────────────── */
 
-static void __ich_emulate_instr(struct pt_regs *regs, uint32_t instr)
+static inline void __ich_resume(struct pt_regs *regs, struct silkhook_ich_hook *h)
 {
-    unsigned int rd, rn;
-
-    /*  nop - d503201f  */
-    if (instr == 0xD503201F)
-        return;
-
-    /*  hint instrs (pac, bti, etc) - d503xxxx  */
-    if ((instr & 0xFFFFF01F) == 0xD503201F)
-        return;
-
-    /*  mov xd, xn (orr xd, xzr, xn) - aa0003e0 | (rn << 16) | rd  */
-    if ((instr & 0xFFE0FFE0) == 0xAA0003E0)
-    {
-        rd = instr & 0x1F;
-        rn = (instr >> 16) & 0x1F;
-        if (rd < 31 && rn < 31)
-            regs->regs[rd] = regs->regs[rn];
-        return;
-    }
-
-    /*  stp x29, x30, [sp, #imm]! - common prologue
-     *  encoding: 1010100110 imm7 Rt2 Rn Rt
-     *  we need to emu stack push  */
-    if ((instr & 0xFFC00000) == 0xA9800000)
-    {
-        int32_t imm7 = (instr >> 15) & 0x7F;
-        unsigned int rt2 = (instr >> 10) & 0x1F;
-        unsigned int rn_reg = (instr >> 5) & 0x1F;
-        unsigned int rt = instr & 0x1F;
-        int64_t offset;
-        uint64_t *sp;
-
-        /*  sign extend imm7  */
-        if (imm7 & 0x40)
-            imm7 |= ~0x7F;
-        offset = imm7 * 8;
-
-        /*  pre-index: sp = sp + offset,  then store  */
-        if (rn_reg == 31)
-        {
-            regs->sp += offset;
-            sp = (uint64_t *)regs->sp;
-            if (rt < 31)
-                sp[0] = regs->regs[rt];
-            if (rt2 < 31)
-                sp[1] = regs->regs[rt2];
-        }
-        return;
-    }
-
-    /*  mrs x0, ...  - common in syscall handlers  */
-    if ((instr & 0xFFF00000) == 0xD5300000)
-        return;
-
-    /*  HOPE FOR THE BEST!!!!  */
-    pr_warn_once("silkhook: [ich] unhandled instr %08x\n", instr);
+#ifdef PSR_BTYPE_MASK
+    regs->pstate &= ~PSR_BTYPE_MASK;
+#endif
+    instruction_pointer_set(regs, h->slot);
 }
 
 
@@ -165,7 +119,7 @@ static int __ich_brk_handler(struct pt_regs *regs, unsigned long esr)
     if (h->coalesce_ctr < h->coalesce_n)
     {
         h->skip_count++;
-        goto emu_n_skip;
+        goto resume;
     }
     h->coalesce_ctr = 0;
 
@@ -180,9 +134,8 @@ static int __ich_brk_handler(struct pt_regs *regs, unsigned long esr)
     h->total_cycles += __ich_cycles() - start_cycles;
     h->exec_count++;
 
-emu_n_skip:
-    __ich_emulate_instr(regs, h->orig_instr);
-    regs->pc += 4;
+resume:
+    __ich_resume(regs, h);
 
     return DBG_HOOK_HANDLED;
 }
@@ -254,7 +207,11 @@ void silkhook__ich_exit(void)
      if (! h || !cfg || !cfg->payload)
          return SILKHOOK_ERR_INVAL;
 
-     if (! __ich_initialised)
+     if (! __ich_initialised || !SILKHOOK_SYNC_TASKS)
+         return SILKHOOK_ERR_STATE;
+
+     /*  brk goes live immediately,  the slot can't wait for a tx commit  */
+     if (__flush_tx_active())
          return SILKHOOK_ERR_STATE;
 
      for (i = 0; timer_syms[i]; i++)
@@ -296,12 +253,23 @@ void silkhook__ich_exit(void)
 
      spin_unlock_irqrestore(&__ich_lock, flags);
 
+     r = __trampoline_create((uintptr_t) targ, SILKHOOK_INSTR_SIZE, &h->slot, 0);
+     if (r != SILKHOOK_OK)
+     {
+         spin_lock_irqsave(&__ich_lock, flags);
+         WRITE_ONCE(__ich_active, NULL);
+         spin_unlock_irqrestore(&__ich_lock, flags);
+         return r;
+     }
+
      r = __mem_write_text(targ, &brk_instr, 4);
      if (r != SILKHOOK_OK)
      {
          spin_lock_irqsave(&__ich_lock, flags);
          WRITE_ONCE(__ich_active, NULL);
          spin_unlock_irqrestore(&__ich_lock, flags);
+         __trampoline_destroy(h->slot);
+         h->slot = 0;
          return r;
      }
 
@@ -328,6 +296,11 @@ int silkhook__ich_remove(struct silkhook_ich_hook *h)
         WRITE_ONCE(__ich_active, NULL);
     spin_unlock_irqrestore(&__ich_lock, flags);
 
+    /*  a cpu may still be eret'ing into the slot  */
+    silkhook_sync_tasks();
+
+    __trampoline_destroy(h->slot);
+    h->slot = 0;
     h->installed = 0;
 
     pr_info("silkhook: ich removed (exec=%llu skip=%llu avg_cyc=%llu) !!!\n",
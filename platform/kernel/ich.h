@@ -37,6 +37,7 @@ struct silkhook_ich_hook
 {
     void          *targ;
     uint32_t      orig_instr;
+    uintptr_t     slot;           /*  reloc'd orig instr + jump back  */
 
     unsigned int  coalesce_n;
     unsigned int  coalesce_ctr;   /*  curr counter      */
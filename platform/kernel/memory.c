@@ -6,6 +6,7 @@
  */
 
 #include "memory.h"
+#include "../../include/types.h"
 #include "../../include/status.h"
 #include "ksyms.h"
 
@@ -15,6 +16,7 @@
 #include <linux/mm.h>
 #include <linux/slab.h>
 #include <asm/cacheflush.h>
+#include <asm/cpufeature.h>
 
 
 /* ─────────────────────────────────────────────────────────────────────────────
@@ -96,6 +98,33 @@ int __mem_alloc_exec(size_t size, void **out)
 	return SILKHOOK_OK;
 }
 
+/*  module_alloc already lands in the module region,  in b reach of
+ *  kernel text unless kaslr spread it out  */
+int __mem_alloc_exec_near(uintptr_t hint, uintptr_t range, size_t size, void **out)
+{
+	(void)hint;
+	(void)range;
+	return __mem_alloc_exec(size, out);
+}
+
+/*  module_alloc mem is written in place  */
+void *__mem_writable(void *rx)
+{
+	return rx;
+}
+
+int __mem_set_mode(int mode)
+{
+	return mode == SILKHOOK_MEM_RWX ? SILKHOOK_OK : SILKHOOK_ERR_INVAL;
+}
+
+/*  always aarch64_insn_patch_text_nosync  */
+int __mem_set_patch_backend(int backend)
+{
+	(void)backend;
+	return SILKHOOK_ERR_INVAL;
+}
+
 int __mem_free(void *ptr, size_t size)
 {
 	(void)size;
@@ -104,11 +133,48 @@ int __mem_free(void *ptr, size_t size)
 	return SILKHOOK_OK;
 }
 
+/*  flush_icache_range already honours CTR_EL0  (IDC / DIC / line sizes)  */
+void __cache_init(void)
+{
+}
+
+/*  BTI_KERNEL maps all kernel + module text w/ PTE_GP  */
+int __mem_guarded(uintptr_t addr)
+{
+	(void)addr;
+#ifdef CONFIG_ARM64_BTI_KERNEL
+	return system_supports_bti();
+#else
+	return 0;
+#endif
+}
+
+/*  kernel cbs bracket simd use w/ kernel_neon_begin(),  stubs never
+ *  spill fp state  */
+int __cpu_sve(void)
+{
+	return 0;
+}
+
 void __flush_icache(void *addr, size_t len)
 {
 	flush_icache_range((unsigned long) addr, (unsigned long) addr + len);
 }
 
+/*  flush_icache_range() minus its per-call kick_all_cpus_sync()  */
+void __flush_icache_clean(const struct __flush_range *r, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		caches_clean_inval_pou(r[i].start, r[i].end);
+}
+
+void __flush_icache_sync(void)
+{
+	kick_all_cpus_sync();
+}
+
 int __mem_write_text(void *dst, const void *src, size_t len)
 {
 	const u32 *instrs = src;
@@ -137,3 +203,24 @@ int __mem_write_code(void *dst, const void *src, size_t len)
 {
 	return __mem_write_text(dst, src, len);
 }
+
+/*  text_poke goes through a fixmap alias,  no prots to coalesce  */
+int __mem_write_code_batch(struct __mem_patch *p, size_t n)
+{
+	size_t i;
+	int ret;
+
+	for (i = 0; i < n; i++)
+	{
+		ret = __mem_write_text(p[i].dst, p[i].src, p[i].len);
+		if (ret != SILKHOOK_OK)
+			return ret;
+	}
+
+	return SILKHOOK_OK;
+}
+
+size_t __mem_page_size(void)
+{
+	return PAGE_SIZE;
+}
@@ -10,6 +10,9 @@
 
 #include <linux/types.h>
 
+/*  shared decls  (__mem_alloc_exec_near,  __flush_icache_clean, ...)  */
+#include "../memory.h"
+
 
 int silkhook_mem_init(void);
 
@@ -7,6 +7,7 @@
 
 #include <linux/kernel.h>
 #include <linux/stop_machine.h>
+#include <linux/rcupdate.h>
 #include <asm/cacheflush.h>
 
 #include "sync.h"
@@ -32,6 +33,23 @@ static int __silkhook_patch_cb(void *dat)
     return 0;
 }
 
+struct __silkhook_sync_batch
+{
+    struct silkhook_sync_ctx *ctx;
+    size_t                   n;
+};
+
+static int __silkhook_patch_batch_cb(void *dat)
+{
+    struct __silkhook_sync_batch *b = dat;
+    size_t i;
+
+    for (i = 0; i < b->n; i++)
+        __silkhook_patch_cb(&b->ctx[i]);
+
+    return 0;
+}
+
 
 /* ─────────────────────────────────────────────────────────────────────────────
  * public API
@@ -49,3 +67,39 @@ int silkhook_patch_sync(void *dst, const void *src, size_t len)
     stop_machine(__silkhook_patch_cb, &ctx, NULL);
     return ctx.result;
 }
+
+
+/*  n patches,  one stop_machine.  per-patch status lands in ctx[i].result  */
+int silkhook_patch_sync_n(struct silkhook_sync_ctx *ctx, size_t n)
+{
+    struct __silkhook_sync_batch b = {
+        .ctx = ctx,
+        .n   = n,
+    };
+    size_t i;
+
+    if (!n)
+        return SILKHOOK_OK;
+
+    for (i = 0; i < n; i++)
+        ctx[i].result = SILKHOOK_OK;
+
+    stop_machine(__silkhook_patch_batch_cb, &b, NULL);
+
+    for (i = 0; i < n; i++)
+        if (ctx[i].result != SILKHOOK_OK)
+            return ctx[i].result;
+
+    return SILKHOOK_OK;
+}
+
+
+/*  tasks-rcu for preempted tasks,  plain rcu for irq / preempt-off code
+ *  incl. the brk handlers  (idle tasks aren't tracked by tasks-rcu)  */
+void silkhook_sync_tasks(void)
+{
+#ifdef CONFIG_TASKS_RCU
+    synchronize_rcu_tasks();
+#endif
+    synchronize_rcu();
+}
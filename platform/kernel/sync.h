@@ -9,6 +9,7 @@
 #define _SILKHOOK_SYNC_H_
 
 #include <linux/types.h>
+#include <linux/kconfig.h>
 
 
 /* ─────────────────────────────────────────────────────────────────────────────
@@ -31,6 +32,16 @@ struct silkhook_sync_ctx
  * ───────────────────────────────────────────────────────────────────────────── */
 
 int silkhook_patch_sync(void *dst, const void *src, size_t len);
+int silkhook_patch_sync_n(struct silkhook_sync_ctx *ctx, size_t n);
+
+/*  returns once no task can still be in code that was reachable before
+ *  the call - preempted in it,  or in a brk handler about to eret into
+ *  it.   may sleep.   a preemptible kernel w/o TASKS_RCU can't wait out
+ *  preempted tasks,  SILKHOOK_SYNC_TASKS is 0 there  */
+#define SILKHOOK_SYNC_TASKS \
+    (IS_ENABLED(CONFIG_TASKS_RCU) || !IS_ENABLED(CONFIG_PREEMPTION))
+
+void silkhook_sync_tasks(void);
 
 
 #endif /* _SILKHOOK_SYNC_H_ */
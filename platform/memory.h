@@ -12,6 +12,7 @@
     #include <linux/types.h>
 #else
     #include <stddef.h>
+    #include <stdint.h>
 #endif
 
 
@@ -27,11 +28,67 @@ int __mem_make_rw(void *addr, size_t len);
 int __mem_make_rx(void *addr, size_t len);
 
 int __mem_alloc_exec(size_t size, void **out);
+
+/*  best effort:  tries to land within ±range of hint,  any addr otherwise  */
+int __mem_alloc_exec_near(uintptr_t hint, uintptr_t range, size_t size, void **out);
 int __mem_free(void *ptr, size_t size);
+
+/*  rw view of exec mem from __mem_alloc_exec*  (identity unless dual mapped)  */
+void *__mem_writable(void *rx);
+
+int __mem_set_mode(int mode);
+int __mem_set_patch_backend(int backend);
 int __mem_write_code(void *dst, const void *src, size_t len);
 
+struct __mem_patch {
+    void        *dst;
+    const void  *src;
+    size_t      len;
+};
+
+/*  sorts p by dst.   patches sharing a page r written under one prot
+ *  flip,  so each text page is dirtied  (cow'd)  once per batch  */
+int __mem_write_code_batch(struct __mem_patch *p, size_t n);
+
+size_t __mem_page_size(void);
+
+#ifndef __KERNEL__
+/*  pthread_atfork prepare  (take = 1)  /  parent + child  (take = 0)  */
+void __mem_fork_lock(int take);
+
+/*  pthread_atfork child,  under the fork locks.   w^x aliases get
+ *  private backing  */
+void __mem_fork_child(void);
+
+/*  every running thread of the process through a full barrier
+ *  (membarrier),  ERR_STATE if the kernel can't do it  */
+int __cpu_barrier_all(void);
+#endif
+
+/*  reads cache geometry once,  before any __flush_icache  */
+void __cache_init(void);
+
+/*  addr's page enforces bti  (cpu has it + the image was built for it)  */
+int __mem_guarded(uintptr_t addr);
+
+/*  cpu has sve,  fp spills need the z / p file  (always 0 in kernel)  */
+int __cpu_sve(void);
 void __flush_icache(void *addr, size_t len);
 
+/*  [start, end),  sorted / merged by the caller  */
+struct __flush_range {
+    uintptr_t   start;
+    uintptr_t   end;
+};
+
+/*  dc / ic to pou over n ranges,  one barrier pass.   other cpus may
+ *  still hold prefetched instrs until __flush_icache_sync()  */
+void __flush_icache_clean(const struct __flush_range *r, size_t n);
+
+/*  context sync on every cpu  (kernel:  one ipi round,  may not be
+ *  called w/ irqs off)  */
+void __flush_icache_sync(void);
+
 #ifdef __KERNEL__
 int __mem_write_text(void *dst, const void *src, size_t len);
 #endif
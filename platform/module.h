@@ -0,0 +1,41 @@
+/*
+ * silkhook - miniature arm64 hooking lib
+ * module.h - loaded module lookup  (userspace)
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _SILKHOOK_MODULE_H_
+#define _SILKHOOK_MODULE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * module lookup
+ *
+ * addrs r stored as  (module name,  off from load bias)  so they survive
+ * aslr.   names come from dl_iterate_phdr,  the main exe is ""
+ *
+ *   addr ──> __mod_find ──> { "libfoo.so", 0x1234 }
+ *   { "libfoo.so", 0x1234 } ──> __mod_base + off ──> addr'
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define __MOD_NAME_MAX  256
+
+/*  module w/ a PT_LOAD covering addr  */
+int __mod_find(uintptr_t addr, char *name, size_t cap, uintptr_t *base);
+
+/*  load bias of the module called name  */
+int __mod_base(const char *name, uintptr_t *base);
+
+/*  first executable PT_LOAD of the module called name  */
+int __mod_text(const char *name, uintptr_t *start, size_t *len);
+
+/*  module covering addr is marked bti  (GNU_PROPERTY_AARCH64_FEATURE_1_BTI),
+ *  i.e. the loader mapped its text PROT_BTI  */
+int __mod_bti(uintptr_t addr);
+
+
+#endif /* _SILKHOOK_MODULE_H_ */
@@ -6,13 +6,38 @@
  */
 
 #define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
 #include "../memory.h"
+#include "../../include/types.h"
 #include "../../include/status.h"
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#ifdef __aarch64__
+    #include <sys/auxv.h>
+    #include "../module.h"
+#endif
+
+#ifndef PROT_BTI
+    #define PROT_BTI    0x10
+#endif
+#ifndef HWCAP2_BTI
+    #define HWCAP2_BTI  (1ul << 17)
+#endif
+#ifndef HWCAP_SVE
+    #define HWCAP_SVE   (1ul << 22)
+#endif
+
+/*  <linux/membarrier.h> isn't always there  */
+#define __MEMBARRIER_PRIVATE_EXPEDITED          (1 << 3)
+#define __MEMBARRIER_REGISTER_PRIVATE_EXPEDITED (1 << 4)
 
 
 /* ─────────────────────────────────────────────────────────────────────────────
@@ -21,6 +46,11 @@
 
 extern void __silkhook_flush_icache(void *addr, size_t len);
 
+#ifdef __aarch64__
+extern void __silkhook_cache_init(void);
+extern void __silkhook_flush_icache_ranges(const struct __flush_range *r, size_t n);
+#endif
+
 
 /* ─────────────────────────────────────────────────────────────────────────────
  * internal helpers
@@ -44,6 +74,65 @@ static inline size_t __page_span(void *p, size_t len)
     return e - s;
 }
 
+static int __bti = -1;
+
+static int __cpu_bti(void)
+{
+#ifdef __aarch64__
+    if (__bti < 0)
+        __bti = !!(getauxval(AT_HWCAP2) & HWCAP2_BTI);
+    return __bti;
+#else
+    return 0;
+#endif
+}
+
+static int __sve = -1;
+
+int __cpu_sve(void)
+{
+#ifdef __aarch64__
+    if (__sve < 0)
+        __sve = !!(getauxval(AT_HWCAP) & HWCAP_SVE);
+    return __sve;
+#else
+    return 0;
+#endif
+}
+
+static int __membarrier = -1;
+
+int __cpu_barrier_all(void)
+{
+#ifdef __NR_membarrier
+    /*  registering twice is harmless,  no lock needed  */
+    if (__membarrier < 0)
+        __membarrier = !syscall(__NR_membarrier, __MEMBARRIER_REGISTER_PRIVATE_EXPEDITED, 0);
+
+    if (__membarrier && !syscall(__NR_membarrier, __MEMBARRIER_PRIVATE_EXPEDITED, 0))
+        return SILKHOOK_OK;
+#endif
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return SILKHOOK_ERR_STATE;
+}
+
+int __mem_guarded(uintptr_t addr)
+{
+#ifdef __aarch64__
+    return __cpu_bti() && __mod_bti(addr);
+#else
+    (void) addr;
+    return 0;
+#endif
+}
+
+/*  mprotect drops PROT_BTI unless it's passed back  */
+static int __text_prot(void *addr)
+{
+    return PROT_READ | PROT_EXEC | (__mem_guarded((uintptr_t) addr) ? PROT_BTI : 0);
+}
+
 
 /* ─────────────────────────────────────────────────────────────────────────────
  * public API
@@ -51,31 +140,265 @@ static inline size_t __page_span(void *p, size_t len)
 
 int __mem_make_rw(void *addr, size_t len)
 {
-    if (mprotect(__page_start(addr), __page_span(addr, len), PROT_READ | PROT_WRITE | PROT_EXEC))
+    if (mprotect(__page_start(addr), __page_span(addr, len), __text_prot(addr) | PROT_WRITE))
         return SILKHOOK_ERR_PROT;
     return SILKHOOK_OK;
 }
 
 int __mem_make_rx(void *addr, size_t len)
 {
-    if (mprotect(__page_start(addr), __page_span(addr, len), PROT_READ | PROT_EXEC))
+    if (mprotect(__page_start(addr), __page_span(addr, len), __text_prot(addr)))
+        return SILKHOOK_ERR_PROT;
+    return SILKHOOK_OK;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * w^x mode
+ *
+ * exec mem is a memfd mapped twice,  code is written through the rw
+ * alias and run from the rx one:
+ *
+ *   memfd ──┬──> rx  (returned,  hooks jump here)
+ *           └──> rw  (__mem_writable)
+ *
+ * targ patching goes through pwrite on /proc/self/mem,  the kernel does
+ * a forced cow write w/o touching vma prots  (no mmap_lock for write)
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+struct __alias {
+    struct __alias *next;
+    uintptr_t       rx;
+    uintptr_t       rw;
+    size_t          size;
+};
+
+static int              __mode      = SILKHOOK_MEM_RWX;
+static int              __patch     = SILKHOOK_PATCH_MPROTECT;
+static int              __patch_set = SILKHOOK_PATCH_MPROTECT;   /*  last picked  */
+static struct __alias  *__aliases   = NULL;
+static int              __procmem   = -1;
+static pthread_mutex_t  __alias_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *__map_dual(void *hint, size_t size)
+{
+    struct __alias *a;
+    void *rx, *rw;
+    int fd;
+
+    a = malloc(sizeof(*a));
+    if (!a)
+        return NULL;
+
+    fd = memfd_create("silkhook", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, (off_t) size))
+        goto fail_fd;
+
+    rx = mmap(hint, size, PROT_READ | PROT_EXEC | (__cpu_bti() ? PROT_BTI : 0),
+              MAP_SHARED, fd, 0);
+    if (rx == MAP_FAILED)
+        goto fail_fd;
+
+    rw = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (rw == MAP_FAILED)
+    {
+        munmap(rx, size);
+        goto fail_fd;
+    }
+
+    /*  mappings keep the file alive  */
+    close(fd);
+
+    a->rx   = (uintptr_t) rx;
+    a->rw   = (uintptr_t) rw;
+    a->size = size;
+
+    pthread_mutex_lock(&__alias_lock);
+    a->next   = __aliases;
+    __aliases = a;
+    pthread_mutex_unlock(&__alias_lock);
+
+    return rx;
+
+fail_fd:
+    if (fd >= 0)
+        close(fd);
+    free(a);
+    return NULL;
+}
+
+static struct __alias *__alias_find(uintptr_t rx)
+{
+    struct __alias *a;
+
+    for (a = __aliases; a; a = a->next)
+        if (rx >= a->rx && rx < a->rx + a->size)
+            return a;
+
+    return NULL;
+}
+
+void *__mem_writable(void *rx)
+{
+    struct __alias *a;
+    void *rw = rx;
+
+    pthread_mutex_lock(&__alias_lock);
+    a = __alias_find((uintptr_t) rx);
+    if (a)
+        rw = (void *) (a->rw + ((uintptr_t) rx - a->rx));
+    pthread_mutex_unlock(&__alias_lock);
+
+    return rw;
+}
+
+static int __procmem_fd(void)
+{
+    int fd;
+
+    pthread_mutex_lock(&__alias_lock);
+    if (__procmem < 0)
+        __procmem = open("/proc/self/mem", O_RDWR | O_CLOEXEC);
+    fd = __procmem;
+    pthread_mutex_unlock(&__alias_lock);
+
+    return fd;
+}
+
+static int __write_procmem(void *dst, const void *src, size_t len)
+{
+    int fd = __procmem_fd();
+
+    if (fd < 0)
+        return SILKHOOK_ERR_PROT;
+
+    if (pwrite(fd, src, len, (off_t) (uintptr_t) dst) != (ssize_t) len)
+        return SILKHOOK_ERR_PROT;
+
+    return SILKHOOK_OK;
+}
+
+int __mem_set_mode(int mode)
+{
+    if (mode != SILKHOOK_MEM_RWX && mode != SILKHOOK_MEM_WXORX)
+        return SILKHOOK_ERR_INVAL;
+
+    /*  fail early rather than on the first hook  */
+    if (mode == SILKHOOK_MEM_WXORX && __procmem_fd() < 0)
+        return SILKHOOK_ERR_PROT;
+
+    /*  back to RWX gets back whatever backend was picked before  */
+    __mode  = mode;
+    __patch = mode == SILKHOOK_MEM_WXORX ? SILKHOOK_PATCH_PROCMEM : __patch_set;
+    return SILKHOOK_OK;
+}
+
+int __mem_set_patch_backend(int backend)
+{
+    if (backend != SILKHOOK_PATCH_MPROTECT && backend != SILKHOOK_PATCH_PROCMEM)
+        return SILKHOOK_ERR_INVAL;
+
+    /*  mprotect would flip targs rwx  */
+    if (backend == SILKHOOK_PATCH_MPROTECT && __mode == SILKHOOK_MEM_WXORX)
+        return SILKHOOK_ERR_STATE;
+
+    if (backend == SILKHOOK_PATCH_PROCMEM && __procmem_fd() < 0)
         return SILKHOOK_ERR_PROT;
+
+    __patch = __patch_set = backend;
     return SILKHOOK_OK;
 }
 
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * exec mem
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static void *__map_exec(void *hint, size_t size)
+{
+    void *p;
+
+    if (__mode == SILKHOOK_MEM_WXORX)
+        return __map_dual(hint, size);
+
+    /*  everything we emit is entered @ a bti c,  so guard it too  */
+    p = mmap(hint, size, PROT_READ | PROT_WRITE | PROT_EXEC | (__cpu_bti() ? PROT_BTI : 0),
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
 int __mem_alloc_exec(size_t size, void **out)
 {
-    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC,
-                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (p == MAP_FAILED)
+    void *p = __map_exec(NULL, size);
+    if (!p)
         return SILKHOOK_ERR_NOMEM;
 
     *out = p;
     return SILKHOOK_OK;
 }
 
+/*  probe a few hints stepping away from the hint,  below first since
+ *  the gap under a loaded image is usually free  */
+#define __NEAR_STEP     (1ul << 20)
+#define __NEAR_TRIES    16
+
+int __mem_alloc_exec_near(uintptr_t hint, uintptr_t range, size_t size, void **out)
+{
+    uintptr_t base = hint & ~(__page_size() - 1);
+    int i;
+
+    /*  i = 0 asks for the hint itself  (packed pool growth)  */
+    for (i = 0; range && i <= __NEAR_TRIES; i++)
+    {
+        uintptr_t d = (uintptr_t) ((i + 1) / 2) * __NEAR_STEP;
+        uintptr_t want;
+        void *p;
+
+        if (d >= range)
+            break;
+
+        if (i & 1)
+        {
+            if (base < d)
+                continue;
+            want = base - d;
+        }
+        else
+            want = base + d;
+
+        p = __map_exec((void *) want, size);
+        if (!p)
+            continue;
+
+        if ((uintptr_t) p - hint + range < 2 * range)
+        {
+            *out = p;
+            return SILKHOOK_OK;
+        }
+
+        __mem_free(p, size);
+    }
+
+    return __mem_alloc_exec(size, out);
+}
+
 int __mem_free(void *ptr, size_t size)
 {
+    struct __alias **pp, *a;
+
+    pthread_mutex_lock(&__alias_lock);
+    for (pp = &__aliases; (a = *pp); pp = &a->next)
+        if (a->rx == (uintptr_t) ptr)
+            break;
+    if (a)
+        *pp = a->next;
+    pthread_mutex_unlock(&__alias_lock);
+
+    if (a)
+    {
+        munmap((void *) a->rw, a->size);
+        free(a);
+    }
+
     if (munmap(ptr, size))
         return SILKHOOK_ERR_NOMEM;
     return SILKHOOK_OK;
@@ -86,20 +409,182 @@ int __mem_write_code(void *dst, const void *src, size_t len)
     long page_size = sysconf(_SC_PAGESIZE);
     uintptr_t page_start = (uintptr_t)dst & ~(page_size - 1);
     size_t page_len = ((uintptr_t)dst + len - page_start + page_size - 1) & ~(page_size - 1);
+    int prot;
+
+    if (__patch == SILKHOOK_PATCH_PROCMEM)
+        return __write_procmem(dst, src, len);
 
-    if (mprotect((void *)page_start, page_len, PROT_READ | PROT_WRITE | PROT_EXEC) != 0)
+    prot = __text_prot(dst);
+
+    if (mprotect((void *)page_start, page_len, prot | PROT_WRITE) != 0)
         return SILKHOOK_ERR_PROT;
 
     memcpy(dst, src, len);
 
     /*  restore read-exec  */
-    mprotect((void *)page_start, page_len, PROT_READ | PROT_EXEC);
+    mprotect((void *)page_start, page_len, prot);
 
     return SILKHOOK_OK;
 }
 
+static void __patch_sort(struct __mem_patch *p, size_t n)
+{
+    size_t i, j;
+
+    for (i = 1; i < n; i++)
+    {
+        struct __mem_patch t = p[i];
+
+        for (j = i; j && (uintptr_t) p[j - 1].dst > (uintptr_t) t.dst; j--)
+            p[j] = p[j - 1];
+        p[j] = t;
+    }
+}
+
+int __mem_write_code_batch(struct __mem_patch *p, size_t n)
+{
+    uintptr_t ps = __page_size();
+    size_t i, j, k;
+    int prot, r;
+
+    __patch_sort(p, n);
+
+    if (__patch == SILKHOOK_PATCH_PROCMEM)
+    {
+        for (i = 0; i < n; i++)
+        {
+            r = __write_procmem(p[i].dst, p[i].src, p[i].len);
+            if (r != SILKHOOK_OK)
+                return r;
+        }
+        return SILKHOOK_OK;
+    }
+
+    /*  group patches whose pages touch,  one rwx / rx pair per group  */
+    for (i = 0; i < n; i = j)
+    {
+        uintptr_t s = (uintptr_t) p[i].dst & ~(ps - 1);
+        uintptr_t e = ((uintptr_t) p[i].dst + p[i].len + ps - 1) & ~(ps - 1);
+
+        for (j = i + 1; j < n && (uintptr_t) p[j].dst < e; j++)
+        {
+            uintptr_t pe = ((uintptr_t) p[j].dst + p[j].len + ps - 1) & ~(ps - 1);
+            if (pe > e)
+                e = pe;
+        }
+
+        prot = __text_prot((void *) s);
+
+        if (mprotect((void *) s, e - s, prot | PROT_WRITE))
+            return SILKHOOK_ERR_PROT;
+
+        for (k = i; k < j; k++)
+            memcpy(p[k].dst, p[k].src, p[k].len);
+
+        mprotect((void *) s, e - s, prot);
+    }
+
+    return SILKHOOK_OK;
+}
+
+size_t __mem_page_size(void)
+{
+    return (size_t) __page_size();
+}
+
+void __mem_fork_lock(int take)
+{
+    if (take)
+        pthread_mutex_lock(&__alias_lock);
+    else
+        pthread_mutex_unlock(&__alias_lock);
+}
+
+/*  both aliases r MAP_SHARED,  so a child writing a slot would rewrite
+ *  code the parent is running.   give each alias its own memfd in the
+ *  child,  same rx addr,  contents copied.   if that can't be done the
+ *  rw side is just unmapped - the child then faults on a write instead
+ *  of landing it in the parent.   /proc/self/mem was opened on the
+ *  parent's mm,  reopened on next use.   caller holds the fork locks  */
+void __mem_fork_child(void)
+{
+    struct __alias **pp = &__aliases, *a;
+    void *rw;
+    int fd;
+
+    if (__procmem >= 0)
+    {
+        close(__procmem);
+        __procmem = -1;
+    }
+
+    while ((a = *pp))
+    {
+        rw = MAP_FAILED;
+        fd = memfd_create("silkhook", MFD_CLOEXEC);
+        if (fd >= 0 && !ftruncate(fd, (off_t) a->size))
+            rw = mmap(NULL, a->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (rw != MAP_FAILED)
+        {
+            memcpy(rw, (void *) a->rw, a->size);
+
+            /*  swaps the pages under the same addr,  nothing's lost  */
+            if (mmap((void *) a->rx, a->size,
+                     PROT_READ | PROT_EXEC | (__cpu_bti() ? PROT_BTI : 0),
+                     MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+            {
+                munmap(rw, a->size);
+                rw = MAP_FAILED;
+            }
+        }
+
+        if (fd >= 0)
+            close(fd);
+
+        munmap((void *) a->rw, a->size);
+
+        if (rw == MAP_FAILED)
+        {
+            *pp = a->next;
+            free(a);
+            continue;
+        }
+
+        a->rw = (uintptr_t) rw;
+        pp = &a->next;
+    }
+}
+
+
+void __cache_init(void)
+{
+#ifdef __aarch64__
+    __silkhook_cache_init();
+#endif
+}
 
 void __flush_icache(void *addr, size_t len)
 {
     __silkhook_flush_icache(addr, len);
 }
+
+void __flush_icache_clean(const struct __flush_range *r, size_t n)
+{
+#ifdef __aarch64__
+    __silkhook_flush_icache_ranges(r, n);
+#else
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        __silkhook_flush_icache((void *) r[i].start, r[i].end - r[i].start);
+#endif
+}
+
+/*  the clean already isb'd this cpu,  there's no ipi to send from here  */
+void __flush_icache_sync(void)
+{
+#ifdef __aarch64__
+    __asm__ volatile("isb" ::: "memory");
+#endif
+}
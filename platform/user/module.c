@@ -0,0 +1,235 @@
+/*
+ * silkhook - miniature arm64 hooking lib
+ * module.c - loaded module lookup  (dl_iterate_phdr)
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define _GNU_SOURCE
+#include "../module.h"
+#include "../../include/status.h"
+
+#include <link.h>
+#include <string.h>
+
+#ifndef PT_GNU_PROPERTY
+    #define PT_GNU_PROPERTY                     0x6474e553
+#endif
+#ifndef NT_GNU_PROPERTY_TYPE_0
+    #define NT_GNU_PROPERTY_TYPE_0              5
+#endif
+#ifndef GNU_PROPERTY_AARCH64_FEATURE_1_AND
+    #define GNU_PROPERTY_AARCH64_FEATURE_1_AND  0xc0000000u
+#endif
+#ifndef GNU_PROPERTY_AARCH64_FEATURE_1_BTI
+    #define GNU_PROPERTY_AARCH64_FEATURE_1_BTI  (1u << 0)
+#endif
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * iterate callbacks
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+struct __mod_query {
+    uintptr_t   addr;
+    const char  *name;
+    char        *out;
+    size_t      cap;
+    uintptr_t   base;
+    size_t      len;
+    int         found;
+};
+
+static int __mod_find_cb(struct dl_phdr_info *info, size_t size, void *data)
+{
+    struct __mod_query *q = data;
+    int i;
+
+    (void) size;
+
+    for (i = 0; i < info->dlpi_phnum; i++)
+    {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        uintptr_t start = info->dlpi_addr + ph->p_vaddr;
+
+        if (ph->p_type != PT_LOAD)
+            continue;
+
+        if (q->addr >= start && q->addr < start + ph->p_memsz)
+        {
+            const char *n = info->dlpi_name ? info->dlpi_name : "";
+
+            if (strlen(n) >= q->cap)
+                return 0;
+
+            strcpy(q->out, n);
+            q->base  = info->dlpi_addr;
+            q->found = 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int __mod_base_cb(struct dl_phdr_info *info, size_t size, void *data)
+{
+    struct __mod_query *q = data;
+    const char *n = info->dlpi_name ? info->dlpi_name : "";
+
+    (void) size;
+
+    if (strcmp(n, q->name))
+        return 0;
+
+    q->base  = info->dlpi_addr;
+    q->found = 1;
+    return 1;
+}
+
+
+static int __mod_text_cb(struct dl_phdr_info *info, size_t size, void *data)
+{
+    struct __mod_query *q = data;
+    const char *n = info->dlpi_name ? info->dlpi_name : "";
+    int i;
+
+    (void) size;
+
+    if (strcmp(n, q->name))
+        return 0;
+
+    for (i = 0; i < info->dlpi_phnum; i++)
+    {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+
+        if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X))
+            continue;
+
+        q->base  = info->dlpi_addr + ph->p_vaddr;
+        q->len   = ph->p_memsz;
+        q->found = 1;
+        break;
+    }
+    return 1;
+}
+
+
+/*  NT_GNU_PROPERTY_TYPE_0:  { u32 type,  u32 size,  data }  8 byte aligned  */
+static int __note_bti(const uint8_t *p, size_t len)
+{
+    const uint8_t *end = p + len;
+
+    while (p + sizeof(ElfW(Nhdr)) <= end)
+    {
+        const ElfW(Nhdr) *nh = (const void *) p;
+        const uint8_t *desc  = p + sizeof(*nh) + ((nh->n_namesz + 3) & ~3u);
+        const uint8_t *dend  = desc + nh->n_descsz;
+
+        if (dend > end)
+            break;
+
+        if (nh->n_type == NT_GNU_PROPERTY_TYPE_0 && nh->n_namesz == 4 &&
+            !memcmp(p + sizeof(*nh), "GNU", 4))
+        {
+            while (desc + 8 <= dend)
+            {
+                uint32_t type, sz, feat;
+
+                memcpy(&type, desc, 4);
+                memcpy(&sz, desc + 4, 4);
+                if (desc + 8 + sz > dend)
+                    break;
+
+                if (type == GNU_PROPERTY_AARCH64_FEATURE_1_AND && sz >= 4)
+                {
+                    memcpy(&feat, desc + 8, 4);
+                    return !!(feat & GNU_PROPERTY_AARCH64_FEATURE_1_BTI);
+                }
+                desc += 8 + ((sz + 7) & ~7u);
+            }
+        }
+
+        p = p + sizeof(*nh) + ((nh->n_namesz + 3) & ~3u) + ((nh->n_descsz + 7) & ~7u);
+    }
+    return 0;
+}
+
+static int __mod_bti_cb(struct dl_phdr_info *info, size_t size, void *data)
+{
+    struct __mod_query *q = data;
+    int i, hit = 0;
+
+    (void) size;
+
+    for (i = 0; i < info->dlpi_phnum && !hit; i++)
+    {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        uintptr_t start = info->dlpi_addr + ph->p_vaddr;
+
+        hit = ph->p_type == PT_LOAD &&
+              q->addr >= start && q->addr < start + ph->p_memsz;
+    }
+
+    if (!hit)
+        return 0;
+
+    for (i = 0; i < info->dlpi_phnum; i++)
+    {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+
+        if (ph->p_type == PT_GNU_PROPERTY)
+            q->found = __note_bti((const uint8_t *) (info->dlpi_addr + ph->p_vaddr),
+                                  ph->p_memsz);
+    }
+    return 1;
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * public
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int __mod_find(uintptr_t addr, char *name, size_t cap, uintptr_t *base)
+{
+    struct __mod_query q = { .addr = addr, .out = name, .cap = cap };
+
+    dl_iterate_phdr(__mod_find_cb, &q);
+    if (!q.found)
+        return SILKHOOK_ERR_NOENT;
+
+    *base = q.base;
+    return SILKHOOK_OK;
+}
+
+int __mod_base(const char *name, uintptr_t *base)
+{
+    struct __mod_query q = { .name = name };
+
+    dl_iterate_phdr(__mod_base_cb, &q);
+    if (!q.found)
+        return SILKHOOK_ERR_NOENT;
+
+    *base = q.base;
+    return SILKHOOK_OK;
+}
+
+int __mod_text(const char *name, uintptr_t *start, size_t *len)
+{
+    struct __mod_query q = { .name = name };
+
+    dl_iterate_phdr(__mod_text_cb, &q);
+    if (!q.found)
+        return SILKHOOK_ERR_NOENT;
+
+    *start = q.base;
+    *len   = q.len;
+    return SILKHOOK_OK;
+}
+
+int __mod_bti(uintptr_t addr)
+{
+    struct __mod_query q = { .addr = addr };
+
+    dl_iterate_phdr(__mod_bti_cb, &q);
+    return q.found;
+}
@@ -7,9 +7,17 @@
 
 #ifdef __KERNEL__
     #include <linux/string.h>
-    #include <linux/spinlock.h>
+    #include <linux/mutex.h>
+    #include <linux/slab.h>
+    #include <linux/percpu.h>
+    #include <linux/sched.h>
+    #include <linux/rcupdate.h>
+    #ifdef SILKHOOK_ARCH_ARM64
+        #include <asm/virt.h>
+    #endif
 #else
     #include <string.h>
+    #include <stdlib.h>
     #include <pthread.h>
 #endif
 
@@ -17,10 +25,19 @@
 #include "include/types.h"
 #include "include/status.h"
 #include "internal/trampoline.h"
+#include "internal/flush.h"
 #include "platform/memory.h"
 
+#ifdef __KERNEL__
+    #include "platform/kernel/sync.h"
+#else
+    #include "platform/module.h"
+#endif
+
 #ifdef SILKHOOK_ARCH_ARM64
     #include "internal/arch.h"
+    #include "internal/relocator.h"
+    #include "internal/stub.h"
 #else
     #include "internal/arch_arm32.h"
 #endif
@@ -30,17 +47,405 @@
  * locking
  * ───────────────────────────────────────────────────────────────────────────── */
 
+/*  a mutex in the kernel too:  module_alloc,  GFP_KERNEL and the flush
+ *  commit's ipi all happen under it  */
 #ifdef __KERNEL__
-    static DEFINE_SPINLOCK(__silkhook_lock);
-    static unsigned long   __silkhook_flags;
-    #define __LOCK()     spin_lock_irqsave(&__silkhook_lock, __silkhook_flags)
-    #define __UNLOCK()   spin_unlock_irqrestore(&__silkhook_lock, __silkhook_flags)
+    static DEFINE_MUTEX(__silkhook_lock);
+    #define __LOCK()     mutex_lock(&__silkhook_lock)
+    #define __UNLOCK()   mutex_unlock(&__silkhook_lock)
 #else
     static pthread_mutex_t __silkhook_lock = PTHREAD_MUTEX_INITIALIZER;
     #define __LOCK()     pthread_mutex_lock(&__silkhook_lock)
     #define __UNLOCK()   pthread_mutex_unlock(&__silkhook_lock)
 #endif
 
+#ifdef __KERNEL__
+    #define __STORE_REL(p, v)   smp_store_release((p), (v))
+    #define __LOAD_ACQ(p)       smp_load_acquire(p)
+#else
+    #define __STORE_REL(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+    #define __LOAD_ACQ(p)       __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#endif
+
+#ifdef __KERNEL__
+    #define __ALLOC(n, sz)  kcalloc((n), (sz), GFP_KERNEL)
+    #define __FREE(p)       kfree(p)
+#else
+    #define __ALLOC(n, sz)  calloc((n), (sz))
+    #define __FREE(p)       free(p)
+#endif
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * gates
+ *
+ * bit n enables group n of the GATED hooks.   entry stubs load the word
+ * on every call,  so flipping it is all a kill switch needs - no text
+ * write,  no flush,  no lock.   calls already past the tbz finish in
+ * the detour
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#ifdef __KERNEL__
+    #define __GATES_ALL         (~0ul)
+    static unsigned long __gates = __GATES_ALL;
+    #define __GATE_ON(g)        set_bit((g), &__gates)
+    #define __GATE_OFF(g)       clear_bit((g), &__gates)
+#else
+    #define __GATES_ALL         (~0ull)
+    static uint64_t __gates = __GATES_ALL;
+    #define __GATE_ON(g)        __atomic_fetch_or(&__gates, 1ull << (g), __ATOMIC_RELEASE)
+    #define __GATE_OFF(g)       __atomic_fetch_and(&__gates, ~(1ull << (g)), __ATOMIC_RELEASE)
+#endif
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * thread / cpu local state
+ *
+ * one u32 countdown per SAMPLED hook,  per thread  (userspace)  or per
+ * cpu  (kernel),  and a u64 group mask per thread for THREAD hooks
+ * (userspace).   stubs reach them off tpidr_el0  /  the per-cpu offset
+ * in tpidr_el1  (tpidr_el2 under vhe)  w/o a call.   sample slots r
+ * handed out under the lock,  a reused one starts from whatever the
+ * last owner left - at most one period off.   a kernel stub preempted
+ * mid-countdown may store to the old cpu's count,  harmless for a sample
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#ifdef SILKHOOK_ARCH_ARM64
+#ifdef __KERNEL__
+    static DEFINE_PER_CPU(u32 [SILKHOOK_MAX_SAMPLED], __samples);
+    #define __TP_MRS()          (is_kernel_in_hyp_mode() ? __MRS_TPIDR_EL2(17) \
+                                                         : __MRS_TPIDR_EL1(17))
+    #define __SAMPLE_OFF(i)     ((uintptr_t) &__samples[(i)])
+#else
+    /*  initial-exec:  fixed offset from tp,  same in every thread  */
+    static __thread uint32_t __samples[SILKHOOK_MAX_SAMPLED]
+        __attribute__((tls_model("initial-exec")));
+    static __thread uint64_t __thread_mask
+        __attribute__((tls_model("initial-exec")));
+    #define __TP_MRS()          __MRS_TPIDR_EL0(17)
+    #define __TP_OFF(p)         ((uintptr_t) (p) - (uintptr_t) __builtin_thread_pointer())
+    #define __SAMPLE_OFF(i)     __TP_OFF(&__samples[(i)])
+#endif
+
+/*  current -> tgid,  for TGID stubs.   fixed for the task's lifetime,  so
+ *  the stub can read it w/o rcu - unlike current->cgroups,  which a
+ *  migration swaps and frees under rcu,  hence no cgroup filter  */
+#ifdef __KERNEL__
+static void __task_hops(struct __entry_stub *e)
+{
+    BUILD_BUG_ON(sizeof(((struct task_struct *) 0)->tgid) != 4);
+    e->hop[0] = offsetof(struct task_struct, tgid);
+    e->n_hops = 1;
+    e->id_w   = 1;
+}
+#endif
+
+static uint64_t __sample_used = 0;
+
+/*  caller holds the lock  */
+static int __sample_get(uint32_t *slot)
+{
+    uint32_t i;
+
+    for (i = 0; i < SILKHOOK_MAX_SAMPLED; i++)
+    {
+        if (!(__sample_used & (1ull << i)))
+        {
+            __sample_used |= 1ull << i;
+            *slot = i;
+            return SILKHOOK_OK;
+        }
+    }
+
+    return SILKHOOK_ERR_NOMEM;
+}
+#endif
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * epochs  (userspace)
+ *
+ * EPOCH stubs keep a per-thread call depth in tls.   unhooking such a
+ * hook retires its trampoline / veneer / stub instead of freeing them,
+ * stamped w/ the scan's epoch.   an entry is freed once every listed
+ * thread's qseq has moved since a scan no older than its stamp - the
+ * thread got back to depth 0 after the unhook - or the thread is gone.
+ * depth 0 alone proves nothing,  a thread can sit between the patched
+ * jmp and its depth store.   the qseq bump and the ret after it run
+ * from the shared thunk,  never from retired code.   w/o membarrier
+ * nothing is freed,  the call path itself has no atomics or barriers.
+ *
+ * a listed thread that never makes another EPOCH call holds back all
+ * that's retired after it went idle,  until it exits.   a thread in its
+ * very first tracked call isn't listed until register takes the lock.
+ *
+ * the thunk keeps a shadow stack of callers' lrs and the detour returns
+ * into the stub,  so EPOCH hooks must not be unwound through:  a
+ * longjmp past one leaves the thread's depth up for good  (nothing is
+ * freed from then on,  still safe),  and the stub has no unwind info -
+ * a c++ exception thrown through it terminates the process
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#if defined(SILKHOOK_ARCH_ARM64) && !defined(__KERNEL__)
+struct __retired {
+    uintptr_t   code[3];        /*  trampoline,  veneer,  stub  -  0 if none  */
+    uint64_t    epoch;
+    struct __retired *next;
+};
+
+static __thread struct __epoch_rec __epoch_self
+    __attribute__((tls_model("initial-exec")));
+
+static pthread_mutex_t    __epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t     __epoch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t      __epoch_key;
+static struct __epoch_rec *__epochs = NULL;
+static struct __retired   *__retired = NULL;
+static uint64_t           __epoch_now = 0;
+static uintptr_t          __epoch_thunk = 0;    /*  never freed  */
+static size_t             __epoch_exit = 0;
+
+static void __epoch_unregister(void *p)
+{
+    struct __epoch_rec **pp;
+
+    pthread_mutex_lock(&__epoch_lock);
+    for (pp = &__epochs; *pp; pp = &(*pp)->next)
+    {
+        if (*pp == p)
+        {
+            *pp = ((struct __epoch_rec *) p)->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&__epoch_lock);
+}
+
+static void __epoch_key_init(void)
+{
+    pthread_key_create(&__epoch_key, __epoch_unregister);
+}
+
+/*  ctx call from the thunk,  once per thread.   starts out not quiescent,
+ *  it's already inside a hook  */
+static void __epoch_register(struct silkhook_pt_regs *regs, void *user)
+{
+    struct __epoch_rec *r = &__epoch_self;
+
+    (void) regs; (void) user;
+
+    /*  first,  hooked calls from in here then skip straight past  */
+    r->on_list = 1;
+
+    pthread_once(&__epoch_once, __epoch_key_init);
+
+    pthread_mutex_lock(&__epoch_lock);
+    r->seen    = r->qseq;
+    r->seen_at = __epoch_now;
+    r->safe    = 0;
+    r->next    = __epochs;
+    __epochs   = r;
+    pthread_mutex_unlock(&__epoch_lock);
+
+    pthread_setspecific(__epoch_key, r);
+}
+
+/*  caller holds __epoch_lock.   returns the newest stamp every listed
+ *  thread has left behind,  0 if it can't tell.   a qseq that moved
+ *  since the last scan moved after everything stamped up to it  */
+static uint64_t __epoch_scan(void)
+{
+    struct __epoch_rec *r;
+    uint64_t min, q;
+
+    /*  bumped either way,  a retire is stamped past every seen_at  */
+    min = ++__epoch_now;
+
+    if (__cpu_barrier_all() != SILKHOOK_OK)
+        return 0;
+
+    for (r = __epochs; r; r = r->next)
+    {
+        q = __LOAD_ACQ(&r->qseq);
+        if (q != r->seen)
+            r->safe = r->seen_at;
+        r->seen    = q;
+        r->seen_at = __epoch_now;
+
+        if (r->safe < min)
+            min = r->safe;
+    }
+
+    return min;
+}
+
+/*  caller holds __epoch_lock  */
+static size_t __epoch_free(uint64_t min)
+{
+    struct __retired **pp = &__retired, *cur;
+    size_t left = 0, i;
+
+    while ((cur = *pp))
+    {
+        if (cur->epoch > min)
+        {
+            left++;
+            pp = &cur->next;
+            continue;
+        }
+
+        for (i = 0; i < 3; i++)
+            if (cur->code[i])
+                __trampoline_destroy(cur->code[i]);
+
+        *pp = cur->next;
+        __FREE(cur);
+    }
+
+    return left;
+}
+
+static void __epoch_retire(uintptr_t tramp, uintptr_t veneer, uintptr_t entry)
+{
+    struct __retired *d = __ALLOC(1, sizeof(*d));
+    uint64_t min;
+
+    pthread_mutex_lock(&__epoch_lock);
+    min = __epoch_scan();
+
+    /*  can't track it,  leaking beats freeing under a caller  */
+    if (d)
+    {
+        d->code[0] = tramp;
+        d->code[1] = veneer;
+        d->code[2] = entry;
+        d->epoch   = __epoch_now;
+        d->next    = __retired;
+        __retired  = d;
+    }
+
+    __epoch_free(min);
+    pthread_mutex_unlock(&__epoch_lock);
+}
+
+/*  caller holds the hook lock.   built on first use,  w/ the first
+ *  EPOCH hook's targ as the pool hint  */
+static int __epoch_thunk_get(uintptr_t hint)
+{
+    struct __epoch_thunk t = {
+        .tp_mrs = __TP_MRS(),
+        .rec    = __TP_OFF(&__epoch_self),
+        .reg    = {
+            .frame = __STUB_REGS_MIN,
+            .fn    = (uintptr_t) __strip_pac((void *) (uintptr_t) __epoch_register),
+            .fp    = __cpu_sve() ? __STUB_FP_SVE : __STUB_FP_NEON,
+        },
+    };
+    int r;
+
+    if (__epoch_thunk)
+        return SILKHOOK_OK;
+
+    r = __trampoline_emit(hint, __stub_emit_epoch_thunk, &t, &__epoch_thunk);
+    if (r == SILKHOOK_OK)
+        __epoch_exit = __epoch_thunk + t.exit;
+    return r;
+}
+
+/*  child has one thread,  the others' recs r just copies  */
+static void __epoch_fork_child(void)
+{
+    __epochs = __epoch_self.on_list ? &__epoch_self : NULL;
+    __epoch_self.next = NULL;
+}
+#endif
+
+#ifndef __KERNEL__
+size_t silkhook_reclaim(void)
+{
+    #ifdef SILKHOOK_ARCH_ARM64
+    size_t left;
+
+    pthread_mutex_lock(&__epoch_lock);
+    left = __epoch_free(__epoch_scan());
+    pthread_mutex_unlock(&__epoch_lock);
+
+    return left;
+    #else
+    return 0;
+    #endif
+}
+#endif
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * deferred free  (kernel)
+ *
+ * a task preempted inside a trampoline / veneer / stub resumes there,
+ * so unhook can't free them once the prologue is back.   each release
+ * queues an rcu-tasks callback instead,  which hands the slots on to
+ * plain rcu for code hit from irqs  (idle tasks aren't tracked by
+ * rcu-tasks).   both batch whatever is queued before a grace period
+ * starts,  so unhooking N hooks costs about one of each,  not N,  and
+ * unhook itself never waits on one.
+ *
+ * a cb that voluntarily sleeps while a stub frame is below it counts as
+ * quiescent,  probe cbs mustn't.   w/o TASKS_RCU plain rcu only covers a
+ * non-preemptible kernel,  a preemptible one can't tell when a preempted
+ * task is out - hooks aren't created there at all  (SILKHOOK_SYNC_TASKS).
+ *
+ * the record is allocated w/ the hook so release can't fail to queue.
+ * the callbacks live in this module,  silkhook_shutdown waits for them
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#ifdef __KERNEL__
+struct __deferred {
+    struct rcu_head rcu;
+    uintptr_t       code[3];    /*  trampoline,  veneer,  stub  -  0 if none  */
+};
+
+static void __deferred_free(struct rcu_head *rcu)
+{
+    struct __deferred *d = container_of(rcu, struct __deferred, rcu);
+    int i;
+
+    for (i = 0; i < 3; i++)
+        if (d->code[i])
+            __trampoline_destroy(d->code[i]);
+
+    kfree(d);
+}
+
+#ifdef CONFIG_TASKS_RCU
+static void __deferred_tasks(struct rcu_head *rcu)
+{
+    call_rcu(rcu, __deferred_free);
+}
+
+    #define __DEFER(h)          call_rcu_tasks((h), __deferred_tasks)
+    #define __DEFER_BARRIER()   do { rcu_barrier_tasks(); rcu_barrier(); } while (0)
+#else
+    #define __DEFER(h)          call_rcu((h), __deferred_free)
+    #define __DEFER_BARRIER()   rcu_barrier()
+#endif
+
+/*  takes d either way  */
+static void __defer_free(struct __deferred *d, uintptr_t tramp, uintptr_t veneer,
+                         uintptr_t entry)
+{
+    if (!tramp && !veneer && !entry)
+    {
+        kfree(d);
+        return;
+    }
+
+    d->code[0] = tramp;
+    d->code[1] = veneer;
+    d->code[2] = entry;
+    __DEFER(&d->rcu);
+}
+#endif
+
 
 /* ─────────────────────────────────────────────────────────────────────────────
  * hook registry
@@ -86,140 +491,556 @@ static struct silkhook_hook *__reg_find(uintptr_t targ)
  * ───────────────────────────────────────────────────────────────────────────── */
 
 extern int __mem_write_code(void *dst, const void *src, size_t len);
-extern void __flush_icache(void *addr, size_t len);
 
+/*  flush deferred to commit inside a tx  */
 static int __write_hook(uintptr_t targ, const void *code, size_t len)
 {
     int r = __mem_write_code((void *) targ, code, len);
     if (r == SILKHOOK_OK)
-        __flush_icache((void *) targ, len);
+        __flush_code((void *) targ, len);
     return r;
 }
 
+/*  one prot flip per text page group,  one flush pass  */
+static int __write_hooks(struct __mem_patch *p, size_t n)
+{
+    size_t i;
+    int r;
 
-/* ─────────────────────────────────────────────────────────────────────────────
- * public api
- * ───────────────────────────────────────────────────────────────────────────── */
+    __flush_tx_begin();
 
-int silkhook_init(void)
-{
-    return SILKHOOK_OK;
+    /*  flush even on failure,  a group may have gone in  */
+    r = __mem_write_code_batch(p, n);
+    for (i = 0; i < n; i++)
+        __flush_code(p[i].dst, p[i].len);
+
+    __flush_tx_commit();
+    return r;
 }
 
-void silkhook_shutdown(void)
+/*  where the patched targ  (and rewritten call sites)  go  */
+#define __HOOK_ENTRY(h) \
+    ((h)->entry ? (h)->entry : (h)->detour)
+
+#ifdef SILKHOOK_ARCH_ARM64
+#define __PG_DELTA(from, to) \
+    ((int64_t) (((to) & ~(uintptr_t) 0xFFF) - ((from) & ~(uintptr_t) 0xFFF)))
+
+static int __hook_padded(const struct silkhook_hook *h)
 {
-    /*  nothing to do  */
+    uint32_t first;
+
+    memcpy(&first, h->orig, sizeof(first));
+    return h->guarded && __IS_LANDING_PAD(first);
 }
 
-int silkhook_create(void *targ, void *detour, struct silkhook_hook *h, void **orig)
+/*  patch = [pad] + jmp,  all within orig_size:
+ *
+ *    16 bytes,  no pad:   ldr x16 / br x16 / .quad          (__ABS_JMP)
+ *    otherwise:           b,  adrp / add / br x16,  or b veneer
+ *
+ *  a pad stays @ targ on guarded pages for blr callers.   chained stubs
+ *  leave less than 16 bytes  */
+static int __hook_veneer(struct silkhook_hook *h)
 {
-    int r;
-    uintptr_t real_targ;
+    size_t off  = __hook_padded(h) ? SILKHOOK_INSTR_SIZE : 0;
+    size_t room = h->orig_size - off;
+    uintptr_t pc = h->targ + off;
+    uintptr_t to = __HOOK_ENTRY(h);
 
-    if (!targ || !detour || !h)
-        return SILKHOOK_ERR_INVAL;
+    if (room == SILKHOOK_HOOK_N_BYTE || __B_REACH(pc, to) ||
+        (room >= 3 * SILKHOOK_INSTR_SIZE &&
+         __IN_RANGE(__PG_DELTA(pc, to), __ADRP_RANGE)))
+        return SILKHOOK_OK;
 
-    __LOCK();
-    memset(h, 0, sizeof(*h));
+    return __trampoline_veneer(pc, to, &h->veneer);
+}
 
-    #ifdef SILKHOOK_ARCH_ARM32
-        h->is_thumb = __IS_THUMB(targ);
-        real_targ = __STRIP_THUMB((uintptr_t) targ);
-        h->targ = real_targ;
-        h->detour = (uintptr_t) detour;
-    #else
-        real_targ = (uintptr_t) targ;
-        h->targ = real_targ;
-        h->detour = (uintptr_t) detour;
-    #endif
+static int __hook_entry(struct silkhook_hook *h)
+{
+    struct __entry_stub e = {
+        .detour = h->detour,
+        .orig   = h->trampoline,
+    };
 
-    h->orig_size = SILKHOOK_HOOK_N_BYTE;
-    h->active = false;
-    h->next = NULL;
+    if (!h->opts.flags && !h->opts.n_pred && !h->ret)
+        return SILKHOOK_OK;
 
-    memcpy(h->orig, (void *) real_targ, SILKHOOK_HOOK_N_BYTE);
+    if (h->opts.flags & SILKHOOK_OPT_GATED)
+    {
+        e.gate = (uintptr_t) &__gates;
+        e.bit  = h->opts.group;
+    }
 
-    r = __trampoline_create(real_targ, h->orig_size, &h->trampoline,
-                            #ifdef SILKHOOK_ARCH_ARM32
-                              h->is_thumb
-                            #else
-                              0
-                            #endif
-    );
+    if (h->opts.flags & SILKHOOK_OPT_SWAP)
+        e.slot = h->ret ? (uintptr_t) &h->retval : (uintptr_t) &h->detour;
 
-    if (r != SILKHOOK_OK)
+    e.ret   = h->ret;
+    e.value = h->retval;
+
+    if (h->opts.flags & SILKHOOK_OPT_SAMPLED)
     {
-        __UNLOCK();
-        return r;
+        uint32_t i;
+        int r = __sample_get(&i);
+
+        if (r != SILKHOOK_OK)
+            return r;
+
+        h->sample = i + 1;
+        e.tp_mrs  = __TP_MRS();
+        e.count   = __SAMPLE_OFF(i);
+        e.period  = h->opts.period;
     }
 
-    if (orig)
+    #ifdef __KERNEL__
+    if (h->opts.flags & SILKHOOK_OPT_TGID)
     {
-    #ifdef SILKHOOK_ARCH_ARM32
-        *orig = (void *) (h->is_thumb ? __ADD_THUMB(h->trampoline) : h->trampoline);
+        __task_hops(&e);
+        e.ids   = h->opts.ids;
+        e.n_ids = h->opts.n_ids;
+    }
     #else
-        *orig = (void *) h->trampoline;
-    #endif
+    if (h->opts.flags & SILKHOOK_OPT_EPOCH)
+    {
+        int r = __epoch_thunk_get(h->targ);
+
+        if (r != SILKHOOK_OK)
+            return r;
+
+        e.epoch      = __epoch_thunk;
+        e.epoch_exit = __epoch_exit;
     }
 
-    __UNLOCK();
-    return SILKHOOK_OK;
-}
+    if (h->opts.flags & SILKHOOK_OPT_THREAD)
+    {
+        e.thread = 1;
+        e.tp_mrs = __TP_MRS();
+        e.mask   = __TP_OFF(&__thread_mask);
+        e.bit    = h->opts.group;
+    }
+    #endif
 
-int silkhook_destroy(struct silkhook_hook *h)
-{
-    if (!h)
-        return SILKHOOK_ERR_INVAL;
+    e.pred   = h->opts.pred;
+    e.n_pred = h->opts.n_pred;
 
-    __LOCK();
+    return __trampoline_emit(h->targ, __stub_emit_entry, &e, &h->entry);
+}
+#endif
 
-    if (h->active)
+/*  everything create made,  h->trampoline may be a foreign stub's dest  */
+static void __hook_release(struct silkhook_hook *h)
+{
+    #ifdef __KERNEL__
+    #ifdef SILKHOOK_ARCH_ARM64
+    __defer_free(h->deferred, h->chained ? 0 : h->trampoline, h->veneer, h->entry);
+    h->veneer = h->entry = 0;
+    #else
+    __defer_free(h->deferred, h->trampoline, 0, 0);
+    #endif
+    h->trampoline = 0;
+    h->deferred   = NULL;
+    #elif defined(SILKHOOK_ARCH_ARM64)
+    if (h->opts.flags & SILKHOOK_OPT_EPOCH)
     {
-        __UNLOCK();
-        return SILKHOOK_ERR_STATE;
+        __epoch_retire(h->chained ? 0 : h->trampoline, h->veneer, h->entry);
+        h->trampoline = h->veneer = h->entry = 0;
     }
+    #endif
 
-    __trampoline_destroy(h->trampoline);
-    memset(h, 0, sizeof(*h));
-
-    __UNLOCK();
-    return SILKHOOK_OK;
+    #ifdef SILKHOOK_ARCH_ARM64
+    if (h->trampoline && !h->chained)
+        __trampoline_destroy(h->trampoline);
+    if (h->veneer)
+        __trampoline_destroy(h->veneer);
+    if (h->entry)
+        __trampoline_destroy(h->entry);
+    if (h->sample)
+        __sample_used &= ~(1ull << (h->sample - 1));
+    #else
+    if (h->trampoline)
+        __trampoline_destroy(h->trampoline);
+    #endif
 }
 
-int silkhook_enable(struct silkhook_hook *h)
+static void __hook_code(const struct silkhook_hook *h, uint32_t *code)
 {
-    uint32_t code[SILKHOOK_HOOK_N_INSTR];
-    int r;
+    #ifdef SILKHOOK_ARCH_ARM64
+    size_t n = h->orig_size / SILKHOOK_INSTR_SIZE, i = 0;
+    uintptr_t to = h->veneer ? h->veneer : __HOOK_ENTRY(h);
+    uintptr_t pc;
+    uint32_t first;
 
-    if (!h)
-        return SILKHOOK_ERR_INVAL;
+    memcpy(&first, h->orig, sizeof(first));
 
-    __LOCK();
+    /*  paciasp can't stay,  the detour would get a signed lr  */
+    if (__hook_padded(h))
+        code[i++] = __IS_BTI(first) ? first : __BTI_C();
+    else if (n == SILKHOOK_HOOK_N_INSTR)
+    {
+        __ABS_JMP(code, __HOOK_ENTRY(h));
+        return;
+    }
 
-    if (h->active || __reg_find(h->targ))
+    pc = h->targ + (i * SILKHOOK_INSTR_SIZE);
+
+    if (__B_REACH(pc, to))
+        code[i++] = __B(to - pc);
+    else
     {
-        __UNLOCK();
-        return SILKHOOK_ERR_EXISTS;
+        code[i++] = __ADRP(16, __PG_DELTA(pc, to));
+        code[i++] = __ADD_IMM(16, 16, to & 0xFFF);
+        code[i++] = __BR(16);
     }
 
-    #ifdef SILKHOOK_ARCH_ARM64
-    __ABS_JMP(code, h->detour);
+    while (i < n)
+        code[i++] = __NOP();
     #else
     if (h->is_thumb)
         __THUMB_ABS_JMP(code, h->detour);
     else
         __ARM32_ABS_JMP(code, __STRIP_THUMB(h->detour));
     #endif
+}
 
-    r = __write_hook(h->targ, code, SILKHOOK_HOOK_N_BYTE);
-    if (r != SILKHOOK_OK)
-    {
-        __UNLOCK();
-        return r;
-    }
-
-    h->active = true;
-    __REG_ADD(h);
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * call sites
+ *
+ * each rewrite pass hangs a block of site addrs off the hook.   restore
+ * only touches sites still holding our bl,  so it can be retried - and
+ * undone:  the blocks r only freed once the whole unhook went through
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+struct silkhook_callsites {
+    struct silkhook_callsites   *next;
+    size_t                      n;
+    uintptr_t                   site[];
+};
+
+#define __CALLS_CHUNK   64
+
+#ifdef SILKHOOK_ARCH_ARM64
+static int __is_call(uintptr_t site, uintptr_t to)
+{
+    uint32_t instr = *(const uint32_t *) site;
+
+    return (instr & __B_MASK) == __BL_OP && site + __DEC_B(instr) == to;
+}
+#endif
+
+/*  every listed site still bl'ing from gets a bl to instead  */
+static int __retarget_calls(struct silkhook_hook *h, uintptr_t from, uintptr_t to)
+{
+    #ifdef SILKHOOK_ARCH_ARM64
+    struct __mem_patch p[__CALLS_CHUNK];
+    uint32_t code[__CALLS_CHUNK];
+    struct silkhook_callsites *c;
+    size_t i, m;
+    int r;
+
+    for (c = h->sites; c; c = c->next)
+    {
+        for (i = 0, m = 0; i < c->n; i++)
+        {
+            if (!__is_call(c->site[i], from))
+                continue;
+
+            code[m]  = __BL(to - c->site[i]);
+            p[m].dst = (void *) c->site[i];
+            p[m].src = &code[m];
+            p[m].len = SILKHOOK_INSTR_SIZE;
+
+            if (++m == __CALLS_CHUNK)
+            {
+                r = __write_hooks(p, m);
+                if (r != SILKHOOK_OK)
+                    return r;
+                m = 0;
+            }
+        }
+
+        if (m && (r = __write_hooks(p, m)) != SILKHOOK_OK)
+            return r;
+    }
+    #else
+    (void) h; (void) from; (void) to;
+    #endif
+
+    return SILKHOOK_OK;
+}
+
+/*  sites back to targ.   the list is kept until __drop_calls,  so an
+ *  unhook that fails later on can __rearm_calls them  */
+static int __restore_calls(struct silkhook_hook *h)
+{
+    #ifdef SILKHOOK_ARCH_ARM64
+    return __retarget_calls(h, __HOOK_ENTRY(h), h->targ);
+    #else
+    (void) h;
+    return SILKHOOK_OK;
+    #endif
+}
+
+/*  best effort,  the unhook is failing already  */
+static void __rearm_calls(struct silkhook_hook *h)
+{
+    #ifdef SILKHOOK_ARCH_ARM64
+    __retarget_calls(h, h->targ, __HOOK_ENTRY(h));
+    #else
+    (void) h;
+    #endif
+}
+
+static void __drop_calls(struct silkhook_hook *h)
+{
+    struct silkhook_callsites *c;
+
+    while ((c = h->sites))
+    {
+        h->sites = c->next;
+        __FREE(c);
+    }
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * public api
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int silkhook_init(void)
+{
+    __cache_init();
+    return SILKHOOK_OK;
+}
+
+int silkhook_set_mem_mode(enum silkhook_mem_mode mode)
+{
+    int r = __mem_set_mode(mode);
+
+    /*  the child needs its own copy of the shared aliases  */
+    #ifndef __KERNEL__
+    if (r == SILKHOOK_OK && mode == SILKHOOK_MEM_WXORX)
+        r = silkhook_atfork_install();
+    #endif
+    return r;
+}
+
+int silkhook_set_patch_backend(enum silkhook_patch_backend backend)
+{
+    return __mem_set_patch_backend(backend);
+}
+
+void silkhook_shutdown(void)
+{
+    /*  deferred frees run module code,  drain them before unload  */
+    #ifdef __KERNEL__
+    __DEFER_BARRIER();
+    #endif
+}
+
+/*  ret != NULL:  no detour,  the entry stub returns *ret itself  */
+static int __hook_create(void *targ, void *detour, struct silkhook_hook *h, void **orig,
+                         const struct silkhook_opts *opts, const uint64_t *ret)
+{
+    int r = SILKHOOK_OK;
+    uintptr_t real_targ;
+    #ifdef SILKHOOK_ARCH_ARM64
+        struct __reloc_stub stub;
+        int guarded, chained;
+    #endif
+    #ifdef __KERNEL__
+        struct __deferred *d;
+    #endif
+
+    if (!targ || (!detour && !ret) || !h)
+        return SILKHOOK_ERR_INVAL;
+
+    if (opts && ((opts->flags & ~SILKHOOK_OPT_HOOK) ||
+                 opts->group >= SILKHOOK_MAX_GROUPS))
+        return SILKHOOK_ERR_INVAL;
+
+    if (opts && (opts->flags & SILKHOOK_OPT_SAMPLED) &&
+        (opts->period < 2 || opts->period > SILKHOOK_MAX_PERIOD))
+        return SILKHOOK_ERR_INVAL;
+
+    #ifdef __KERNEL__
+    if (opts && (opts->flags & (SILKHOOK_OPT_THREAD | SILKHOOK_OPT_EPOCH)))
+        return SILKHOOK_ERR_INVAL;
+    #else
+    if (opts && (opts->flags & SILKHOOK_OPT_TGID))
+        return SILKHOOK_ERR_INVAL;
+    #endif
+
+    if (opts && (opts->flags & SILKHOOK_OPT_TGID))
+    {
+        if (!opts->ids || !opts->n_ids || opts->n_ids > SILKHOOK_MAX_IDS)
+            return SILKHOOK_ERR_INVAL;
+    }
+
+    #ifdef SILKHOOK_ARCH_ARM32
+    if (ret || (opts && (opts->flags || opts->n_pred)))
+        return SILKHOOK_ERR_INSTR;
+    #endif
+
+    #ifdef __KERNEL__
+    /*  unhook couldn't tell when the code is free  */
+    if (!SILKHOOK_SYNC_TASKS)
+        return SILKHOOK_ERR_STATE;
+
+    d = kmalloc(sizeof(*d), GFP_KERNEL);
+    if (!d)
+        return SILKHOOK_ERR_NOMEM;
+    #endif
+
+    #ifdef SILKHOOK_ARCH_ARM64
+        real_targ = (uintptr_t) __strip_pac(targ);
+
+        /*  module walks,  keep them outside the lock.   a chained orig
+         *  gets blr'd,  so on a guarded page it needs its own pad  */
+        guarded = __mem_guarded(real_targ);
+        chained = __reloc_follow((const uint32_t *) real_targ, real_targ,
+                                 SILKHOOK_HOOK_N_BYTE, &stub) &&
+                  (!__mem_guarded(stub.dest) ||
+                   __IS_LANDING_PAD(*(const uint32_t *) stub.dest));
+    #endif
+
+    __LOCK();
+    memset(h, 0, sizeof(*h));
+
+    #ifdef __KERNEL__
+        h->deferred = d;
+    #endif
+
+    #ifdef SILKHOOK_ARCH_ARM32
+        h->is_thumb = __IS_THUMB(targ);
+        real_targ = __STRIP_THUMB((uintptr_t) targ);
+        h->targ = real_targ;
+        h->detour = (uintptr_t) detour;
+    #else
+        h->targ = real_targ;
+        h->detour = (uintptr_t) __strip_pac(detour);
+        h->guarded = guarded;
+        h->ret = !!ret;
+        h->retval = ret ? *ret : 0;
+    #endif
+
+    h->orig_size = SILKHOOK_HOOK_N_BYTE;
+    if (opts)
+        h->opts = *opts;
+    h->active = false;
+    h->next = NULL;
+
+    memcpy(h->orig, (void *) real_targ, SILKHOOK_HOOK_N_BYTE);
+
+    /*  someone else's jmp stub:  orig is where it goes,  only the stub
+     *  itself gets overwritten  (and restored)  */
+    #ifdef SILKHOOK_ARCH_ARM64
+    if (chained)
+    {
+        h->orig_size  = stub.len;
+        h->trampoline = stub.dest;
+        h->chained    = true;
+    }
+    else
+    #endif
+        r = __trampoline_create(real_targ, h->orig_size, &h->trampoline,
+                                #ifdef SILKHOOK_ARCH_ARM32
+                                  h->is_thumb
+                                #else
+                                  0
+                                #endif
+        );
+
+    #ifdef SILKHOOK_ARCH_ARM64
+    if (r == SILKHOOK_OK)
+        r = __hook_entry(h);
+    h->opts.pred = NULL;    /*  compiled in,  caller's arrays may go  */
+    h->opts.ids  = NULL;
+    if (r == SILKHOOK_OK)
+        r = __hook_veneer(h);
+    #endif
+
+    if (r != SILKHOOK_OK)
+    {
+        __hook_release(h);
+        memset(h, 0, sizeof(*h));
+        __UNLOCK();
+        return r;
+    }
+
+    h->orig_ptr = orig;
+
+    if (orig)
+    {
+    #ifdef SILKHOOK_ARCH_ARM32
+        *orig = (void *) (h->is_thumb ? __ADD_THUMB(h->trampoline) : h->trampoline);
+    #else
+        *orig = (void *) h->trampoline;
+    #endif
+    }
+
+    __UNLOCK();
+    return SILKHOOK_OK;
+}
+
+int silkhook_create_ex(void *targ, void *detour, struct silkhook_hook *h, void **orig,
+                       const struct silkhook_opts *opts)
+{
+    return __hook_create(targ, detour, h, orig, opts, NULL);
+}
+
+int silkhook_create(void *targ, void *detour, struct silkhook_hook *h, void **orig)
+{
+    return silkhook_create_ex(targ, detour, h, orig, NULL);
+}
+
+int silkhook_destroy(struct silkhook_hook *h)
+{
+    if (!h)
+        return SILKHOOK_ERR_INVAL;
+
+    __LOCK();
+
+    if (h->active)
+    {
+        __UNLOCK();
+        return SILKHOOK_ERR_STATE;
+    }
+
+    __hook_release(h);
+    memset(h, 0, sizeof(*h));
+
+    __UNLOCK();
+    return SILKHOOK_OK;
+}
+
+int silkhook_enable(struct silkhook_hook *h)
+{
+    uint32_t code[SILKHOOK_HOOK_N_INSTR];
+    int r;
+
+    if (!h)
+        return SILKHOOK_ERR_INVAL;
+
+    __LOCK();
+
+    if (h->active || __reg_find(h->targ))
+    {
+        __UNLOCK();
+        return SILKHOOK_ERR_EXISTS;
+    }
+
+    __hook_code(h, code);
+
+    r = __write_hook(h->targ, code, h->orig_size);
+    if (r != SILKHOOK_OK)
+    {
+        __UNLOCK();
+        return r;
+    }
+
+    h->active = true;
+    __REG_ADD(h);
 
     __UNLOCK();
     return SILKHOOK_OK;
@@ -240,13 +1061,18 @@ int silkhook_disable(struct silkhook_hook *h)
         return SILKHOOK_ERR_STATE;
     }
 
-    r = __write_hook(h->targ, h->orig, h->orig_size);
+    r = __restore_calls(h);
+    if (r == SILKHOOK_OK)
+        r = __write_hook(h->targ, h->orig, h->orig_size);
+
     if (r != SILKHOOK_OK)
     {
+        __rearm_calls(h);
         __UNLOCK();
         return r;
     }
 
+    __drop_calls(h);
     h->active = false;
     __REG_REMOVE(h);
 
@@ -254,9 +1080,10 @@ int silkhook_disable(struct silkhook_hook *h)
     return SILKHOOK_OK;
 }
 
-int silkhook_hook(void *targ, void *detour, struct silkhook_hook *h, void **orig)
+int silkhook_hook_ex(void *targ, void *detour, struct silkhook_hook *h, void **orig,
+                     const struct silkhook_opts *opts)
 {
-    int r = silkhook_create(targ, detour, h, orig);
+    int r = silkhook_create_ex(targ, detour, h, orig, opts);
     if (r != SILKHOOK_OK)
         return r;
 
@@ -269,6 +1096,11 @@ int silkhook_hook(void *targ, void *detour, struct silkhook_hook *h, void **orig
     return SILKHOOK_OK;
 }
 
+int silkhook_hook(void *targ, void *detour, struct silkhook_hook *h, void **orig)
+{
+    return silkhook_hook_ex(targ, detour, h, orig, NULL);
+}
+
 int silkhook_unhook(struct silkhook_hook *h)
 {
     int r = silkhook_disable(h);
@@ -278,12 +1110,1034 @@ int silkhook_unhook(struct silkhook_hook *h)
     return silkhook_destroy(h);
 }
 
-bool silkhook_is_active(struct silkhook_hook *h)
+/* ─────────────────────────────────────────────────────────────────────────────
+ * probes
+ *
+ * one instr mid function becomes a b to a pooled stub,  so the stub has
+ * to be in b reach - there's no free reg to jmp through there,  and the
+ * moved instr is relocated w/o one too  (__reloc_probe).   the hook is
+ * otherwise a normal one:  orig_size 4,  detour = trampoline =
+ * the stub,  enable / disable / unhook all apply
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int silkhook_probe_at_ex(void *addr, silkhook_probe_fn cb, void *user, struct silkhook_hook *h,
+                         const struct silkhook_opts *opts)
 {
-    if (!h)
-        return false;
-    return h->active;
+    #ifdef SILKHOOK_ARCH_ARM64
+    uint32_t flags = opts ? opts->flags : 0;
+    struct __probe_stub p;
+    uintptr_t stub;
+    int r;
+    #ifdef __KERNEL__
+        struct __deferred *d;
+    #endif
+
+    if (!addr || !cb || !h || (flags & ~SILKHOOK_OPT_PROBE))
+        return SILKHOOK_ERR_INVAL;
+
+    #ifdef __KERNEL__
+    if (!SILKHOOK_SYNC_TASKS)
+        return SILKHOOK_ERR_STATE;
+    #endif
+
+    p.pc = (uintptr_t) __strip_pac(addr);
+    if (p.pc & (SILKHOOK_INSTR_SIZE - 1))
+        return SILKHOOK_ERR_INVAL;
+
+    p.instr = *(const uint32_t *) p.pc;
+    p.fn    = (uintptr_t) __strip_pac((void *) (uintptr_t) cb);
+    p.arg   = (uintptr_t) user;
+    p.bti   = __mem_guarded(p.pc);
+    #ifdef __KERNEL__
+    p.fp    = __STUB_FP_NONE;
+    #else
+    p.fp    = (flags & SILKHOOK_OPT_NOFP) ? __STUB_FP_NONE :
+              __cpu_sve()                 ? __STUB_FP_SVE  : __STUB_FP_NEON;
+    #endif
+
+    /*  a pad here is a branch targ,  a b in its place would fault  */
+    if (p.bti && __IS_LANDING_PAD(p.instr))
+        return SILKHOOK_ERR_INSTR;
+
+    r = __reloc_check(&p.instr, 1, p.pc);
+    if (r != SILKHOOK_OK)
+        return r;
+
+    r = __trampoline_emit(p.pc, __stub_emit_probe, &p, &stub);
+    if (r != SILKHOOK_OK)
+        return r;
+
+    if (!__B_REACH(p.pc, stub))
+    {
+        __trampoline_destroy(stub);
+        return SILKHOOK_ERR_NOMEM;
+    }
+
+    #ifdef __KERNEL__
+    d = kmalloc(sizeof(*d), GFP_KERNEL);
+    if (!d)
+    {
+        __trampoline_destroy(stub);
+        return SILKHOOK_ERR_NOMEM;
+    }
+    #endif
+
+    __LOCK();
+    memset(h, 0, sizeof(*h));
+    #ifdef __KERNEL__
+    h->deferred   = d;
+    #endif
+    h->targ       = p.pc;
+    h->detour     = stub;
+    h->trampoline = stub;
+    h->orig_size  = SILKHOOK_INSTR_SIZE;
+    h->guarded    = p.bti;
+    h->probe      = true;
+    h->opts.flags = flags;
+    memcpy(h->orig, &p.instr, sizeof(p.instr));
+    __UNLOCK();
+
+    r = silkhook_enable(h);
+    if (r != SILKHOOK_OK)
+        silkhook_destroy(h);
+    return r;
+    #else
+    (void) addr; (void) cb; (void) user; (void) h; (void) opts;
+    return SILKHOOK_ERR_INSTR;
+    #endif
+}
+
+int silkhook_probe_at(void *addr, silkhook_probe_fn cb, void *user, struct silkhook_hook *h)
+{
+    return silkhook_probe_at_ex(addr, cb, user, h, NULL);
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * constant returns
+ *
+ * the entry stub ends in mov x0, #value ; ret  (or a load from h->retval
+ * w/ SWAP)  instead of a jmp to a detour.   gate / sample / preds still
+ * apply,  whatever they let through goes to orig as usual
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int silkhook_hook_return(void *targ, uint64_t value, struct silkhook_hook *h,
+                         const struct silkhook_opts *opts)
+{
+    int r = __hook_create(targ, NULL, h, NULL, opts, &value);
+    if (r != SILKHOOK_OK)
+        return r;
+
+    r = silkhook_enable(h);
+    if (r != SILKHOOK_OK)
+        silkhook_destroy(h);
+    return r;
+}
+
+int silkhook_hook_fail(void *targ, uint64_t value, uint32_t n, struct silkhook_hook *h)
+{
+    struct silkhook_opts o = { .flags = SILKHOOK_OPT_SAMPLED,  .period = n };
+
+    if (!n)
+        return SILKHOOK_ERR_INVAL;
+
+    return silkhook_hook_return(targ, value, h, n > 1 ? &o : NULL);
+}
+
+int silkhook_set_return(struct silkhook_hook *h, uint64_t value)
+{
+    if (!h)
+        return SILKHOOK_ERR_INVAL;
+
+    #ifdef SILKHOOK_ARCH_ARM64
+    if (!h->ret || !(h->opts.flags & SILKHOOK_OPT_SWAP))
+        return SILKHOOK_ERR_STATE;
+
+    __STORE_REL(&h->retval, value);
+    return SILKHOOK_OK;
+    #else
+    (void) value;
+    return SILKHOOK_ERR_STATE;
+    #endif
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * detour swap
+ *
+ * SWAP entry stubs read h->detour per call,  so a new detour is one
+ * store-release - no text write,  no window where calls hit orig.   a
+ * call that loaded the old ptr may still be running in the old detour,
+ * keep it around until those have drained
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int silkhook_set_detour(struct silkhook_hook *h, void *detour)
+{
+    if (!h || !detour)
+        return SILKHOOK_ERR_INVAL;
+
+    if (!(h->opts.flags & SILKHOOK_OPT_SWAP) || !h->entry)
+        return SILKHOOK_ERR_STATE;
+
+    #ifdef SILKHOOK_ARCH_ARM64
+        if (h->ret)
+            return SILKHOOK_ERR_STATE;
+        detour = __strip_pac(detour);
+    #endif
+
+    __STORE_REL(&h->detour, (uintptr_t) detour);
+    return SILKHOOK_OK;
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * kill switch
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+void silkhook_disable_all_fast(void)
+{
+    __STORE_REL(&__gates, 0);
+}
+
+void silkhook_enable_all_fast(void)
+{
+    __STORE_REL(&__gates, __GATES_ALL);
+}
+
+int silkhook_group_enable(unsigned group, bool on)
+{
+    if (group >= SILKHOOK_MAX_GROUPS)
+        return SILKHOOK_ERR_INVAL;
+
+    if (on)
+        __GATE_ON(group);
+    else
+        __GATE_OFF(group);
+    return SILKHOOK_OK;
+}
+
+uint64_t silkhook_gates(void)
+{
+    return (uint64_t) __LOAD_ACQ(&__gates);
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * thread masks
+ *
+ * THREAD stubs read the calling thread's own mask,  so a plain store is
+ * enough - no other thread ever looks at it
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#ifndef __KERNEL__
+void silkhook_thread_enable(uint64_t mask)
+{
+    #ifdef SILKHOOK_ARCH_ARM64
+        __thread_mask = mask;
+    #else
+        (void) mask;
+    #endif
+}
+
+uint64_t silkhook_thread_mask(void)
+{
+    #ifdef SILKHOOK_ARCH_ARM64
+        return __thread_mask;
+    #else
+        return 0;
+    #endif
+}
+#endif
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * batch
+ *
+ * all n prologues go in w/ one __mem_write_code_batch - hooks sharing
+ * a text page share its prot flip and its cow fault.   all or nothing
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/*  opts:  one per desc,  or NULL for none  */
+static int __hook_batch(struct silkhook_desc *descs, const struct silkhook_opts *opts,
+                        size_t n, struct silkhook_hook *hooks)
+{
+    uint32_t (*code)[SILKHOOK_HOOK_N_INSTR] = NULL;
+    struct __mem_patch *p = NULL;
+    size_t made = 0, i, j;
+    int r = SILKHOOK_OK;
+
+    if (!descs || !hooks)
+        return SILKHOOK_ERR_INVAL;
+
+    if (!n)
+        return SILKHOOK_OK;
+
+    p    = __ALLOC(n, sizeof(*p));
+    code = __ALLOC(n, sizeof(*code));
+    if (!p || !code)
+    {
+        r = SILKHOOK_ERR_NOMEM;
+        goto out;
+    }
+
+    for (made = 0; made < n; made++)
+    {
+        r = silkhook_create_ex(descs[made].targ, descs[made].detour,
+                               &hooks[made], descs[made].orig, opts ? &opts[made] : NULL);
+        if (r != SILKHOOK_OK)
+            goto out;
+    }
+
+    __LOCK();
+
+    for (i = 0; r == SILKHOOK_OK && i < n; i++)
+    {
+        if (__reg_find(hooks[i].targ))
+            r = SILKHOOK_ERR_EXISTS;
+
+        for (j = 0; j < i; j++)
+            if (hooks[j].targ == hooks[i].targ)
+                r = SILKHOOK_ERR_EXISTS;
+
+        __hook_code(&hooks[i], code[i]);
+        p[i].dst = (void *) hooks[i].targ;
+        p[i].src = code[i];
+        p[i].len = hooks[i].orig_size;
+    }
+
+    if (r == SILKHOOK_OK)
+    {
+        r = __write_hooks(p, n);
+
+        /*  put back whatever did go in  */
+        if (r != SILKHOOK_OK)
+        {
+            for (i = 0; i < n; i++)
+            {
+                p[i].dst = (void *) hooks[i].targ;
+                p[i].src = hooks[i].orig;
+                p[i].len = hooks[i].orig_size;
+            }
+            __write_hooks(p, n);
+        }
+    }
+
+    if (r == SILKHOOK_OK)
+    {
+        for (i = 0; i < n; i++)
+        {
+            hooks[i].active = true;
+            __REG_ADD(&hooks[i]);
+        }
+    }
+
+    __UNLOCK();
+
+out:
+    if (r != SILKHOOK_OK)
+        while (made--)
+            silkhook_destroy(&hooks[made]);
+
+    __FREE(code);
+    __FREE(p);
+    return r;
+}
+
+int silkhook_hook_batch(struct silkhook_desc *descs, size_t n, struct silkhook_hook *hooks)
+{
+    return __hook_batch(descs, NULL, n, hooks);
+}
+
+int silkhook_unhook_batch(struct silkhook_hook *hooks, size_t n)
+{
+    uint32_t (*code)[SILKHOOK_HOOK_N_INSTR] = NULL;
+    struct __mem_patch *p = NULL;
+    int r = SILKHOOK_OK;
+    size_t i;
+
+    if (!hooks)
+        return SILKHOOK_ERR_INVAL;
+
+    if (!n)
+        return SILKHOOK_OK;
+
+    p    = __ALLOC(n, sizeof(*p));
+    code = __ALLOC(n, sizeof(*code));
+    if (!p || !code)
+    {
+        r = SILKHOOK_ERR_NOMEM;
+        goto out;
+    }
+
+    __LOCK();
+
+    for (i = 0; r == SILKHOOK_OK && i < n; i++)
+        if (!hooks[i].active)
+            r = SILKHOOK_ERR_STATE;
+
+    if (r != SILKHOOK_OK)
+    {
+        __UNLOCK();
+        goto out;
+    }
+
+    for (i = 0; r == SILKHOOK_OK && i < n; i++)
+    {
+        r = __restore_calls(&hooks[i]);
+
+        p[i].dst = (void *) hooks[i].targ;
+        p[i].src = hooks[i].orig;
+        p[i].len = hooks[i].orig_size;
+    }
+
+    if (r == SILKHOOK_OK)
+    {
+        r = __write_hooks(p, n);
+
+        /*  re-arm whatever got restored  */
+        if (r != SILKHOOK_OK)
+        {
+            for (i = 0; i < n; i++)
+            {
+                __hook_code(&hooks[i], code[i]);
+                p[i].dst = (void *) hooks[i].targ;
+                p[i].src = code[i];
+                p[i].len = hooks[i].orig_size;
+            }
+            __write_hooks(p, n);
+        }
+    }
+
+    /*  the hooks stay active,  so do their rewritten sites  (i is one
+     *  past the last one touched,  or n)  */
+    if (r != SILKHOOK_OK)
+        while (i--)
+            __rearm_calls(&hooks[i]);
+
+    if (r == SILKHOOK_OK)
+    {
+        for (i = 0; i < n; i++)
+        {
+            __drop_calls(&hooks[i]);
+            hooks[i].active = false;
+            __REG_REMOVE(&hooks[i]);
+        }
+    }
+
+    __UNLOCK();
+
+    if (r == SILKHOOK_OK)
+        for (i = 0; i < n; i++)
+            silkhook_destroy(&hooks[i]);
+
+out:
+    __FREE(code);
+    __FREE(p);
+    return r;
+}
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * call-site rewrite
+ *
+ * candidates r collected w/o the lock,  then re-checked under it -
+ * the lock is only held for O(sites),  not for the scan
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#ifdef SILKHOOK_ARCH_ARM64
+static size_t __scan_calls(uintptr_t s, uintptr_t e, uintptr_t targ, uintptr_t to,
+                           uintptr_t *out, size_t cap)
+{
+    size_t n = 0;
+
+    for (; s + SILKHOOK_INSTR_SIZE <= e; s += SILKHOOK_INSTR_SIZE)
+    {
+        if (!__is_call(s, targ) || !__B_REACH(s, to))
+            continue;
+
+        if (out && n == cap)
+            break;
+        if (out)
+            out[n] = s;
+        n++;
+    }
+
+    return n;
+}
+
+static int __in_hook(uintptr_t site)
+{
+    struct silkhook_hook *cur;
+
+    for (cur = __reg; cur; cur = cur->next)
+        if (site >= cur->targ && site < cur->targ + cur->orig_size)
+            return 1;
+
+    return 0;
+}
+#endif
+
+int silkhook_rewrite_calls(struct silkhook_hook *h, void *start, size_t len, size_t *n)
+{
+    #ifdef SILKHOOK_ARCH_ARM64
+    uintptr_t s = ((uintptr_t) start + 3) & ~(uintptr_t) 3;
+    uintptr_t e = (uintptr_t) start + len;
+    struct silkhook_callsites *c = NULL;
+    struct __mem_patch *p = NULL;
+    uint32_t *code = NULL;
+    size_t cnt, m = 0, i;
+    int r = SILKHOOK_OK;
+
+    if (n)
+        *n = 0;
+
+    if (!h || !start)
+        return SILKHOOK_ERR_INVAL;
+
+    cnt = __scan_calls(s, e, h->targ, __HOOK_ENTRY(h), NULL, 0);
+    if (!cnt)
+        return SILKHOOK_OK;
+
+    c    = __ALLOC(1, sizeof(*c) + (cnt * sizeof(c->site[0])));
+    p    = __ALLOC(cnt, sizeof(*p));
+    code = __ALLOC(cnt, sizeof(*code));
+    if (!c || !p || !code)
+    {
+        r = SILKHOOK_ERR_NOMEM;
+        goto out;
+    }
+
+    cnt = __scan_calls(s, e, h->targ, __HOOK_ENTRY(h), c->site, cnt);
+
+    __LOCK();
+
+    if (!h->active)
+        r = SILKHOOK_ERR_STATE;
+
+    /*  text may have moved on since the scan,  and a hooked prologue's
+     *  bytes aren't instrs anymore  */
+    for (i = 0; r == SILKHOOK_OK && i < cnt; i++)
+    {
+        if (!__is_call(c->site[i], h->targ) || __in_hook(c->site[i]))
+            continue;
+
+        c->site[m] = c->site[i];
+        code[m]    = __BL(__HOOK_ENTRY(h) - c->site[m]);
+        p[m].dst   = (void *) c->site[m];
+        p[m].src   = &code[m];
+        p[m].len   = SILKHOOK_INSTR_SIZE;
+        m++;
+    }
+
+    if (r == SILKHOOK_OK && m)
+    {
+        c->n = m;
+        r = __write_hooks(p, m);
+
+        /*  put back whatever did go in  */
+        if (r != SILKHOOK_OK)
+        {
+            for (i = 0; i < m; i++)
+                code[i] = __BL(h->targ - c->site[i]);
+            __write_hooks(p, m);
+        }
+    }
+
+    if (r == SILKHOOK_OK && m)
+    {
+        c->next  = h->sites;
+        h->sites = c;
+        c        = NULL;
+    }
+
+    __UNLOCK();
+
+    if (r == SILKHOOK_OK && n)
+        *n = m;
+
+out:
+    __FREE(code);
+    __FREE(p);
+    __FREE(c);
+    return r;
+    #else
+    (void) h; (void) start; (void) len;
+    if (n)
+        *n = 0;
+    return SILKHOOK_ERR_INSTR;
+    #endif
+}
+
+#ifndef __KERNEL__
+int silkhook_rewrite_calls_mod(struct silkhook_hook *h, const char *mod, size_t *n)
+{
+    uintptr_t start;
+    size_t len;
+    int r;
+
+    if (!mod)
+        return SILKHOOK_ERR_INVAL;
+
+    r = __mod_text(mod, &start, &len);
+    if (r != SILKHOOK_OK)
+        return r;
+
+    return silkhook_rewrite_calls(h, (void *) start, len, n);
+}
+#endif
+
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * fork / cow accounting
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int silkhook_set_tramp_layout(enum silkhook_tramp_layout layout)
+{
+    return __trampoline_set_layout(layout);
+}
+
+static int __hook_spans(const struct silkhook_hook *h, uintptr_t pg, uintptr_t ps)
+{
+    return h->targ < pg + ps && h->targ + h->orig_size > pg;
+}
+
+int silkhook_page_stats(struct silkhook_page_stats *st)
+{
+    uintptr_t ps = (uintptr_t) __mem_page_size();
+    struct silkhook_hook *cur, *prev;
+
+    if (!st)
+        return SILKHOOK_ERR_INVAL;
+
+    memset(st, 0, sizeof(*st));
+
+    __LOCK();
+
+    /*  quadratic,  but it's a stats call and n is the hook count  */
+    for (cur = __reg; cur; cur = cur->next)
+    {
+        uintptr_t pg   = cur->targ & ~(ps - 1);
+        uintptr_t last = (cur->targ + cur->orig_size - 1) & ~(ps - 1);
+
+        st->hooks++;
+
+        for (; pg <= last; pg += ps)
+        {
+            for (prev = __reg; prev != cur; prev = prev->next)
+                if (__hook_spans(prev, pg, ps))
+                    break;
+
+            if (prev == cur)
+                st->text_pages++;
+        }
+    }
+
+    __UNLOCK();
+
+    st->tramp_pages = __trampoline_pages();
+    return SILKHOOK_OK;
+}
+
+#ifndef __KERNEL__
+/*  a fork mid hook would leave the child w/ held locks.   same order as
+ *  everywhere else:  hook lock,  epoch lock,  then the pool / mem / flush
+ *  ones reclaim and retire take under it  */
+static void __atfork_prepare(void)
+{
+    __LOCK();
+    #ifdef SILKHOOK_ARCH_ARM64
+    pthread_mutex_lock(&__epoch_lock);
+    #endif
+    __trampoline_fork_lock(1);
+    __mem_fork_lock(1);
+    __flush_fork_lock(1);
+}
+
+static void __atfork_release(void)
+{
+    __flush_fork_lock(0);
+    __mem_fork_lock(0);
+    __trampoline_fork_lock(0);
+    #ifdef SILKHOOK_ARCH_ARM64
+    pthread_mutex_unlock(&__epoch_lock);
+    #endif
+    __UNLOCK();
+}
+
+static void __atfork_child(void)
+{
+    __mem_fork_child();
+    __flush_fork_child();
+    #ifdef SILKHOOK_ARCH_ARM64
+    __epoch_fork_child();
+    #endif
+    __atfork_release();
+}
+
+static bool __atfork_done = false;
+
+int silkhook_atfork_install(void)
+{
+    int r = SILKHOOK_OK;
+
+    __LOCK();
+    if (!__atfork_done)
+    {
+        if (pthread_atfork(__atfork_prepare, __atfork_release, __atfork_child))
+            r = SILKHOOK_ERR_NOMEM;
+        else
+            __atfork_done = true;
+    }
+    __UNLOCK();
+
+    return r;
+}
+#endif /* __KERNEL__ */
+
+int silkhook_tx_begin(void)
+{
+    __flush_tx_begin();
+    return SILKHOOK_OK;
+}
+
+int silkhook_tx_commit(void)
+{
+    return __flush_tx_commit();
+}
+
+bool silkhook_is_active(struct silkhook_hook *h)
+{
+    if (!h)
+        return false;
+    return h->active;
+}
+
+#ifndef __KERNEL__
+/* ─────────────────────────────────────────────────────────────────────────────
+ * snapshot / restore  (userspace)
+ *
+ *   ┌──────────────┐
+ *   │ hdr          │  magic,  ver,  n_mods,  n_hooks,  size
+ *   ├──────────────┤
+ *   │ hooks[]      │  { mod,  off } x targ / detour / orig ptr + orig bytes,
+ *   │              │  opts
+ *   ├──────────────┤
+ *   │ mods[]       │  u16 len + name  (no nul)
+ *   └──────────────┘
+ *
+ * restore is bias + off,  no symbol lookups.   trampolines r rebuilt,
+ * not copied - relocator output depends on the slot <-> targ distance,
+ * which changes w/ every layout.   every addr is checked against its
+ * module's PT_LOADs and orig bytes r compared first,  so a different
+ * build of a lib fails before anything is patched  (or read)
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define __SNAP_MAGIC        0x4E534853u     /*  "SHSN"  */
+#define __SNAP_VERSION      2u
+#define __SNAP_MAX_MODS     64
+#define __SNAP_NO_MOD       0xFFFFu
+
+/*  probe / return stubs live in the pool,  not in a module.   predicates
+ *  may point at caller data  */
+#ifdef SILKHOOK_ARCH_ARM64
+    #define __SNAP_SKIP(h)  ((h)->probe || (h)->ret || (h)->opts.n_pred)
+#else
+    #define __SNAP_SKIP(h)  0
+#endif
+
+struct __snap_hdr {
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    n_mods;
+    uint32_t    n_hooks;
+    uint32_t    size;
+};
+
+struct __snap_ref {
+    uint16_t    mod;
+    uint16_t    _pad[3];
+    uint64_t    off;
+};
+
+struct __snap_hook {
+    struct __snap_ref   targ;
+    struct __snap_ref   detour;
+    struct __snap_ref   orig_ptr;
+    uint8_t             orig[SILKHOOK_HOOK_N_BYTE];
+    uint8_t             is_thumb;
+    uint8_t             group;          /*  struct silkhook_opts  */
+    uint16_t            _pad;
+    uint32_t            flags;
+    uint32_t            period;
+    uint32_t            _pad2;
+};
+
+struct __snap_mods {
+    size_t      n;
+    char        name[__SNAP_MAX_MODS][__MOD_NAME_MAX];
+};
+
+static int __snap_encode(struct __snap_mods *m, uintptr_t addr, struct __snap_ref *out)
+{
+    char name[__MOD_NAME_MAX];
+    uintptr_t base;
+    size_t i;
+
+    memset(out, 0, sizeof(*out));
+
+    if (!addr)
+    {
+        out->mod = __SNAP_NO_MOD;
+        return SILKHOOK_OK;
+    }
+
+    if (__mod_find(addr, name, sizeof(name), &base) != SILKHOOK_OK)
+        return SILKHOOK_ERR_NOENT;
+
+    for (i = 0; i < m->n; i++)
+        if (!strcmp(m->name[i], name))
+            break;
+
+    if (i == m->n)
+    {
+        if (m->n == __SNAP_MAX_MODS)
+            return SILKHOOK_ERR_NOMEM;
+        strcpy(m->name[m->n++], name);
+    }
+
+    out->mod = (uint16_t) i;
+    out->off = addr - base;
+    return SILKHOOK_OK;
+}
+
+static uintptr_t __snap_decode(const uintptr_t *bases, const struct __snap_ref *ref)
+{
+    return ref->mod == __SNAP_NO_MOD ? 0 : bases[ref->mod] + (uintptr_t) ref->off;
+}
+
+/*  decoded [addr, addr + len) lies in a PT_LOAD of the module it was
+ *  decoded against - an off from another build may point anywhere  */
+static int __snap_mapped(const uintptr_t *bases, const struct __snap_ref *ref, size_t len)
+{
+    char name[__MOD_NAME_MAX];
+    uintptr_t addr = __snap_decode(bases, ref), b;
+
+    if (ref->mod == __SNAP_NO_MOD)
+        return 1;
+
+    return __mod_find(addr, name, sizeof(name), &b) == SILKHOOK_OK &&
+           b == bases[ref->mod] &&
+           __mod_find(addr + len - 1, name, sizeof(name), &b) == SILKHOOK_OK &&
+           b == bases[ref->mod];
+}
+
+int silkhook_snapshot(void *buf, size_t cap, size_t *len, size_t *skipped)
+{
+    struct __snap_hdr hdr = { .magic = __SNAP_MAGIC, .version = __SNAP_VERSION };
+    struct __snap_hook *ents = NULL;
+    struct __snap_mods *mods;
+    struct silkhook_hook *cur;
+    size_t n = 0, skip = 0, size, i;
+    uint8_t *p;
+    int r = SILKHOOK_OK;
+
+    if (!len)
+        return SILKHOOK_ERR_INVAL;
+
+    mods = calloc(1, sizeof(*mods));
+    if (!mods)
+        return SILKHOOK_ERR_NOMEM;
+
+    __LOCK();
+
+    for (cur = __reg; cur; cur = cur->next)
+    {
+        if (__SNAP_SKIP(cur))
+            skip++;
+        else
+            n++;
+    }
+
+    if (n && !(ents = calloc(n, sizeof(*ents))))
+        r = SILKHOOK_ERR_NOMEM;
+
+    for (cur = __reg, i = 0; r == SILKHOOK_OK && cur; cur = cur->next)
+    {
+        if (__SNAP_SKIP(cur))
+            continue;
+
+        r = __snap_encode(mods, cur->targ, &ents[i].targ);
+        if (r == SILKHOOK_OK)
+            r = __snap_encode(mods, cur->detour, &ents[i].detour);
+        if (r == SILKHOOK_OK)
+            r = __snap_encode(mods, (uintptr_t) cur->orig_ptr, &ents[i].orig_ptr);
+
+        memcpy(ents[i].orig, cur->orig, SILKHOOK_HOOK_N_BYTE);
+        ents[i].flags = cur->opts.flags;
+        ents[i].group = (uint8_t) cur->opts.group;
+        ents[i].period = cur->opts.period;
+        #ifdef SILKHOOK_ARCH_ARM32
+            ents[i].is_thumb = cur->is_thumb;
+        #endif
+        i++;
+    }
+
+    __UNLOCK();
+
+    if (skipped)
+        *skipped = skip;
+
+    if (r != SILKHOOK_OK)
+        goto out;
+
+    size = sizeof(hdr) + (n * sizeof(*ents));
+    for (i = 0; i < mods->n; i++)
+        size += sizeof(uint16_t) + strlen(mods->name[i]);
+
+    *len = size;
+    if (!buf || cap < size)
+    {
+        r = SILKHOOK_ERR_NOMEM;
+        goto out;
+    }
+
+    hdr.n_mods  = (uint16_t) mods->n;
+    hdr.n_hooks = (uint32_t) n;
+    hdr.size    = (uint32_t) size;
+
+    p = buf;
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+
+    if (n)
+        memcpy(p, ents, n * sizeof(*ents));
+    p += n * sizeof(*ents);
+
+    for (i = 0; i < mods->n; i++)
+    {
+        uint16_t l = (uint16_t) strlen(mods->name[i]);
+
+        memcpy(p, &l, sizeof(l));
+        memcpy(p + sizeof(l), mods->name[i], l);
+        p += sizeof(l) + l;
+    }
+
+out:
+    free(ents);
+    free(mods);
+    return r;
+}
+
+int silkhook_restore(const void *blob, size_t len, struct silkhook_hook *hooks, size_t n)
+{
+    const uint8_t *p = blob, *end = (const uint8_t *) blob + len;
+    uintptr_t bases[__SNAP_MAX_MODS];
+    char name[__MOD_NAME_MAX];
+    struct silkhook_desc *descs = NULL;
+    struct silkhook_opts *opts = NULL;
+    struct __snap_hdr hdr;
+    struct __snap_hook e;
+    const uint8_t *ents;
+    size_t i;
+    int r = SILKHOOK_OK;
+
+    if (!blob || !hooks || len < sizeof(hdr))
+        return SILKHOOK_ERR_INVAL;
+
+    memcpy(&hdr, p, sizeof(hdr));
+    if (hdr.magic != __SNAP_MAGIC || hdr.version != __SNAP_VERSION ||
+        hdr.size != len || hdr.n_mods > __SNAP_MAX_MODS ||
+        hdr.n_hooks > (len - sizeof(hdr)) / sizeof(e))
+        return SILKHOOK_ERR_INVAL;
+
+    if (n < hdr.n_hooks)
+        return SILKHOOK_ERR_NOMEM;
+
+    ents = p + sizeof(hdr);
+    p    = ents + (hdr.n_hooks * sizeof(e));
+
+    /*  mod names -> load bias in this process  */
+    for (i = 0; i < hdr.n_mods; i++)
+    {
+        uint16_t l;
+
+        if (p + sizeof(l) > end)
+            return SILKHOOK_ERR_INVAL;
+        memcpy(&l, p, sizeof(l));
+        p += sizeof(l);
+
+        if (l >= sizeof(name) || p + l > end)
+            return SILKHOOK_ERR_INVAL;
+        memcpy(name, p, l);
+        name[l] = '\0';
+        p += l;
+
+        r = __mod_base(name, &bases[i]);
+        if (r != SILKHOOK_OK)
+            return r;
+    }
+
+    /*  verify all before patching any  */
+    for (i = 0; i < hdr.n_hooks; i++)
+    {
+        memcpy(&e, ents + (i * sizeof(e)), sizeof(e));
+
+        if (e.targ.mod >= hdr.n_mods || e.detour.mod >= hdr.n_mods ||
+            (e.orig_ptr.mod != __SNAP_NO_MOD && e.orig_ptr.mod >= hdr.n_mods))
+            return SILKHOOK_ERR_INVAL;
+
+        if (!__snap_mapped(bases, &e.targ, SILKHOOK_HOOK_N_BYTE) ||
+            !__snap_mapped(bases, &e.detour, SILKHOOK_INSTR_SIZE) ||
+            !__snap_mapped(bases, &e.orig_ptr, sizeof(void *)))
+            return SILKHOOK_ERR_STATE;
+
+        if (memcmp((void *) __snap_decode(bases, &e.targ), e.orig, SILKHOOK_HOOK_N_BYTE))
+            return SILKHOOK_ERR_STATE;
+    }
+
+    if (!hdr.n_hooks)
+        return SILKHOOK_OK;
+
+    descs = malloc(hdr.n_hooks * sizeof(*descs));
+    opts  = calloc(hdr.n_hooks, sizeof(*opts));
+    if (!descs || !opts)
+    {
+        r = SILKHOOK_ERR_NOMEM;
+        goto out;
+    }
+
+    for (i = 0; i < hdr.n_hooks; i++)
+    {
+        uintptr_t targ;
+
+        memcpy(&e, ents + (i * sizeof(e)), sizeof(e));
+        opts[i].flags  = e.flags;
+        opts[i].group  = e.group;
+        opts[i].period = e.period;
+
+        targ = __snap_decode(bases, &e.targ);
+        #ifdef SILKHOOK_ARCH_ARM32
+            if (e.is_thumb)
+                targ = __ADD_THUMB(targ);
+        #endif
+
+        descs[i].targ   = (void *) targ;
+        descs[i].detour = (void *) __snap_decode(bases, &e.detour);
+        descs[i].orig   = (void **) __snap_decode(bases, &e.orig_ptr);
+    }
+
+    /*  trampolines first,  then every patch in one batched write.   all
+     *  or nothing.   the tx folds the trampolines' flushes into one too  */
+    silkhook_tx_begin();
+    r = __hook_batch(descs, opts, hdr.n_hooks, hooks);
+    silkhook_tx_commit();
+
+out:
+    free(opts);
+    free(descs);
+    return r;
 }
+#endif /* __KERNEL__ */
 
 const char *silkhook_strerror(int err)
 {
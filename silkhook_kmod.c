@@ -493,6 +493,9 @@ static void __exit silkhook_mod_exit(void)
 
     silkhook__svc_remove(&__svc_hook);
 
+    /*  pending deferred frees run our code,  drain them before it goes  */
+    silkhook_shutdown();
+
     pr_info("silkhook: unloaded !!!\n");
 }
 